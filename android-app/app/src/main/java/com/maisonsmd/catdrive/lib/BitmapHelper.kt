@@ -8,11 +8,18 @@ import android.util.Size
 import androidx.core.graphics.scale
 import androidx.core.graphics.toColor
 import timber.log.Timber
+import java.io.ByteArrayOutputStream
 import kotlin.experimental.and
 import kotlin.experimental.or
 import kotlin.math.sqrt
 
 class BitmapHelper {
+    companion object {
+        // Colours of an indexed icon
+        const val PALETTE_SIZE = 16
+        // Spread between the strongest and weakest channel of a coloured pixel
+        private const val COLOR_CHROMA_THRESHOLD = 48
+    }
 
     // Draw bitmap without antialiasing
     class AliasingDrawableWrapper(wrapped: Drawable?) : DrawableWrapper(wrapped) {
@@ -48,6 +55,145 @@ class BitmapHelper {
         return buffer
     }
 
+    /**
+     * Anti-aliased icon, 2 bits of coverage per pixel (0 = background, 3 = foreground), leftmost
+     * pixel in the high bits. The turn arrow is the bright, opaque part of the icon.
+     */
+    fun toGray2Buffer(source: Bitmap, size: Size): ByteArray {
+        val scaled = source.scale(size.width, size.height, true)
+        val byteWidth = (size.width + 3) / 4
+        val buffer = ByteArray(byteWidth * size.height) { _ -> 0 }
+
+        for (y in 0 until size.height) {
+            for (x in 0 until size.width) {
+                val pixel = scaled.getPixel(x, y)
+                val brightness = maxOf(Color.red(pixel), Color.green(pixel), Color.blue(pixel))
+                val coverage = Color.alpha(pixel) * brightness / 255
+                val level = (coverage * 3 + 127) / 255
+                val byteIndex = y * byteWidth + x / 4
+                buffer[byteIndex] = buffer[byteIndex] or (level shl (6 - 2 * (x % 4))).toByte()
+            }
+        }
+        return buffer
+    }
+
+    /**
+     * Whether the icon has colours worth keeping (lane guidance, highway shields), turn arrows are
+     * shades of a single colour
+     */
+    fun isColored(source: Bitmap): Boolean {
+        for (y in 0 until source.height) {
+            for (x in 0 until source.width) {
+                val pixel = source.getPixel(x, y)
+                if (Color.alpha(pixel) < 128) continue
+                val r = Color.red(pixel)
+                val g = Color.green(pixel)
+                val b = Color.blue(pixel)
+                if (maxOf(r, g, b) - minOf(r, g, b) > COLOR_CHROMA_THRESHOLD) return true
+            }
+        }
+        return false
+    }
+
+    /**
+     * Palette-indexed colour icon, scaled to fit `maxSize` with its aspect ratio kept:
+     * [width][height][16 x RGB565 palette, little endian][4-bit indices, leftmost pixel in the
+     * high bits, rows padded to whole bytes]. Transparent pixels are drawn over white, the icon
+     * background on the device. The palette holds the most used colours.
+     */
+    fun toIndexed4Buffer(source: Bitmap, maxSize: Size): ByteArray {
+        val scale = minOf(
+            maxSize.width.toFloat() / source.width,
+            maxSize.height.toFloat() / source.height
+        )
+        val w = (source.width * scale).toInt().coerceIn(1, maxSize.width)
+        val h = (source.height * scale).toInt().coerceIn(1, maxSize.height)
+        val scaled = source.scale(w, h, true)
+
+        val pixels = IntArray(w * h) { i ->
+            val pixel = scaled.getPixel(i % w, i / w)
+            val alpha = Color.alpha(pixel)
+            fun over(channel: Int) = (channel * alpha + 255 * (255 - alpha)) / 255
+            toRgb565(over(Color.red(pixel)), over(Color.green(pixel)), over(Color.blue(pixel)))
+        }
+
+        val palette = pixels.toList()
+            .groupingBy { it }
+            .eachCount()
+            .entries
+            .sortedByDescending { it.value }
+            .take(PALETTE_SIZE)
+            .map { it.key }
+        val indices = HashMap<Int, Int>()
+        fun indexOf(color: Int) = indices.getOrPut(color) {
+            palette.indices.minByOrNull { rgb565Distance(color, palette[it]) } ?: 0
+        }
+
+        val byteWidth = (w + 1) / 2
+        val buffer = ByteArray(2 + 2 * PALETTE_SIZE + byteWidth * h) { _ -> 0 }
+        buffer[0] = w.toByte()
+        buffer[1] = h.toByte()
+        for ((i, color) in palette.withIndex()) {
+            buffer[2 + 2 * i] = (color and 0xFF).toByte()
+            buffer[3 + 2 * i] = (color shr 8).toByte()
+        }
+        for (y in 0 until h) {
+            for (x in 0 until w) {
+                val byteIndex = 2 + 2 * PALETTE_SIZE + y * byteWidth + x / 2
+                val index = indexOf(pixels[y * w + x])
+                buffer[byteIndex] = buffer[byteIndex] or (index shl (4 - 4 * (x % 2))).toByte()
+            }
+        }
+        return buffer
+    }
+
+    private fun toRgb565(r: Int, g: Int, b: Int): Int {
+        return ((r shr 3) shl 11) or ((g shr 2) shl 5) or (b shr 3)
+    }
+
+    private fun rgb565Distance(c1: Int, c2: Int): Int {
+        val r = ((c1 shr 11) and 0x1F) - ((c2 shr 11) and 0x1F)
+        val g = ((c1 shr 5) and 0x3F) - ((c2 shr 5) and 0x3F)
+        val b = (c1 and 0x1F) - (c2 and 0x1F)
+        // Green has one more bit
+        return 4 * r * r + g * g + 4 * b * b
+    }
+
+    /**
+     * PackBits encode, the device decodes it straight into its render buffer
+     */
+    fun packBits(data: ByteArray): ByteArray {
+        val out = ByteArrayOutputStream()
+        var i = 0
+
+        while (i < data.size) {
+            // Repeated byte
+            var run = 1
+            while (i + run < data.size && run < 128 && data[i + run] == data[i]) {
+                run++
+            }
+            if (run >= 2) {
+                out.write(1 - run)
+                out.write(data[i].toInt())
+                i += run
+                continue
+            }
+
+            // Literal bytes, until the next repeat
+            val start = i
+            while (i < data.size && i - start < 128) {
+                if (i + 1 < data.size && data[i] == data[i + 1]) {
+                    break
+                }
+                i++
+            }
+            out.write(i - start - 1)
+            out.write(data, start, i - start)
+        }
+
+        return out.toByteArray()
+    }
+
     private fun ditherImage(source: Bitmap): Bitmap {
         val out = Bitmap.createBitmap(source.width, source.height, Bitmap.Config.ARGB_8888)
         val canvas = Canvas(out)
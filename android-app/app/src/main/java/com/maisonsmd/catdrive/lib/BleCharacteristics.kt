@@ -7,5 +7,10 @@ class BleCharacteristics {
         const val CHA_NAV = "0b11deef-1563-447f-aece-d3dfeb1c1f20"
         const val CHA_NAV_TBT_ICON = "d4d8fcca-16b2-4b8e-8ed5-90137c44a8ad"
         const val CHA_GPS_SPEED = "98b6073a-5cf3-4e73-b6d3-f8e05fa018a9"
+        const val CHA_NAV_SYNC = "5b0c3a2e-8f6d-4b1a-9c47-2e1f6a8d3b90"
+        const val CHA_NAV_TBT_ICON_ACK = "7e2d9f41-3c58-4a06-b1e3-94d2c7a05f6b"
+        const val CHA_NAV_TBT_ICON_MANIFEST = "c3a8e5f2-6d14-4b97-8e0a-5f29b6d4c1e7"
+        const val CHA_TELEMETRY = "2f8b6d1e-4c7a-4e53-9b20-d6e8a3f5c719"
+        const val CCCD_UUID = "00002902-0000-1000-8000-00805f9b34fb"
     }
 }
\ No newline at end of file
@@ -1,7 +1,19 @@
 package com.maisonsmd.catdrive.lib
 
 class BleWriteQueue {
-    data class QueueItem(val uuid: String, val data: ByteArray, val overwrite: Boolean = true) {
+    enum class Operation {
+        WRITE,
+        // Enable notifications of the characteristic
+        SUBSCRIBE,
+        READ
+    }
+
+    data class QueueItem(
+        val uuid: String,
+        val data: ByteArray,
+        val overwrite: Boolean = true,
+        val operation: Operation = Operation.WRITE
+    ) {
         override fun equals(other: Any?): Boolean {
             if (this === other) return true
             if (javaClass != other?.javaClass) return false
@@ -10,6 +22,7 @@ class BleWriteQueue {
 
             if (uuid != other.uuid) return false
             if (!data.contentEquals(other.data)) return false
+            if (operation != other.operation) return false
 
             return true
         }
@@ -17,6 +30,7 @@ class BleWriteQueue {
         override fun hashCode(): Int {
             var result = uuid.hashCode()
             result = 31 * result + data.contentHashCode()
+            result = 31 * result + operation.hashCode()
             return result
         }
     }
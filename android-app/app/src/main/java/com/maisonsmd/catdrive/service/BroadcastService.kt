@@ -25,6 +25,7 @@ import android.location.LocationListener
 import android.location.LocationManager
 import android.os.Binder
 import android.os.IBinder
+import android.os.SystemClock
 import android.util.Size
 import androidx.localbroadcastmanager.content.LocalBroadcastManager
 import com.maisonsmd.catdrive.MainActivity
@@ -33,16 +34,20 @@ import com.maisonsmd.catdrive.SHARED_PREFERENCES_FILE
 import com.maisonsmd.catdrive.lib.BitmapHelper
 import com.maisonsmd.catdrive.lib.BleCharacteristics
 import com.maisonsmd.catdrive.lib.BleWriteQueue
+import com.maisonsmd.catdrive.lib.BleWriteQueue.Operation
 import com.maisonsmd.catdrive.lib.BleWriteQueue.QueueItem
 import com.maisonsmd.catdrive.lib.Intents
 import com.maisonsmd.catdrive.lib.NavigationData
 import com.maisonsmd.catdrive.utils.PermissionCheck
 import timber.log.Timber
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
 import java.security.MessageDigest
 import java.security.NoSuchAlgorithmException
 import java.util.Timer
 import java.util.TimerTask
 import java.util.UUID
+import java.util.zip.CRC32
 import kotlin.math.ceil
 
 
@@ -50,6 +55,15 @@ import kotlin.math.ceil
 class BleService : Service(), LocationListener {
     companion object {
         private const val NOTIFICATION_ID = 1201
+        // Icons the device decodes ahead of time, see nextIcons
+        private const val UPCOMING_ICON_COUNT = 3
+        private const val ICON_SIZE = 64
+        // Icon formats, +1 when PackBits encoded, see sendIconHeader
+        private const val ICON_FORMAT_1BPP = 0
+        private const val ICON_FORMAT_2BPP = 2
+        private const val ICON_FORMAT_I4 = 4
+        // Width, height and palette before the indices of an I4 icon
+        private const val INDEXED_HEADER_SIZE = 2 + 2 * BitmapHelper.PALETTE_SIZE
     }
 
     inner class LocalBinder : Binder() {
@@ -72,6 +86,18 @@ class BleService : Service(), LocationListener {
     private var mDataWriteQueue: BleWriteQueue = BleWriteQueue()
     private var mIsSending: Boolean = false
     private var mIconMap: MutableMap<String, ByteArray> = mutableMapOf()
+    // Format of each icon in mIconMap
+    private var mIconFormats: MutableMap<String, Int> = mutableMapOf()
+    // Navigation fields as last sent to the device, deltas are computed against this
+    private var mLastSentNavigation: MutableMap<String, String> = mutableMapOf()
+    private var mNavigationSeq: Int = 0
+    private var mMtu: Int = 23
+    // Icons whose chunked transfer has not been confirmed by the device yet
+    private var mIconTransfers: MutableMap<String, ByteArray> = mutableMapOf()
+    // Bloom filter of the icons cached on the device, read once per connection
+    private var mDeviceIconManifest: ByteArray? = null
+    // How many maneuvers showed each icon since connecting
+    private var mIconCounts: MutableMap<String, Int> = mutableMapOf()
 
     private val navigationReceiver: BroadcastReceiver = object : BroadcastReceiver() {
         override fun onReceive(context: Context?, intent: Intent) {
@@ -238,6 +264,9 @@ class BleService : Service(), LocationListener {
 
         override fun onMtuChanged(gatt: BluetoothGatt?, mtu: Int, status: Int) {
             super.onMtuChanged(gatt, mtu, status)
+            if (status == BluetoothGatt.GATT_SUCCESS) {
+                mMtu = mtu
+            }
             gatt?.discoverServices()
             mConnectionState = BluetoothProfile.STATE_CONNECTING
         }
@@ -255,10 +284,19 @@ class BleService : Service(), LocationListener {
                 mIsSending = false
                 mDataWriteQueue.clear()
                 mIconMap.clear()
+                mIconFormats.clear()
+                mLastSentNavigation.clear()
+                mIconTransfers.clear()
+                mDeviceIconManifest = null
+                mIconCounts.clear()
 
                 updateNotificationText("Connected to ${mDevice!!.name}")
                 stopReconnectTimer()
                 startPingTimer()
+                subscribe(BleCharacteristics.CHA_NAV_SYNC)
+                subscribe(BleCharacteristics.CHA_NAV_TBT_ICON_ACK)
+                subscribe(BleCharacteristics.CHA_TELEMETRY)
+                read(BleCharacteristics.CHA_NAV_TBT_ICON_MANIFEST)
                 sendPreferencesToDevice()
 
                 LocalBroadcastManager.getInstance(applicationContext).sendBroadcast(
@@ -287,6 +325,124 @@ class BleService : Service(), LocationListener {
                 write(mDataWriteQueue.pop())
             }
         }
+
+        @Deprecated("Deprecated in Java")
+        override fun onCharacteristicRead(
+            gatt: BluetoothGatt?,
+            characteristic: BluetoothGattCharacteristic?,
+            status: Int
+        ) {
+            Timber.d("onCharacteristicRead: $status (0 means success)")
+
+            if (status == BluetoothGatt.GATT_SUCCESS &&
+                characteristic?.uuid?.toString() == BleCharacteristics.CHA_NAV_TBT_ICON_MANIFEST
+            ) {
+                mDeviceIconManifest = characteristic.value
+                Timber.i("Device has ${deviceIconCount()} icons cached")
+            }
+
+            mIsSending = false
+            if (mDataWriteQueue.size > 0) {
+                write(mDataWriteQueue.pop())
+            }
+        }
+
+        override fun onDescriptorWrite(
+            gatt: BluetoothGatt?,
+            descriptor: BluetoothGattDescriptor?,
+            status: Int
+        ) {
+            super.onDescriptorWrite(gatt, descriptor, status)
+
+            Timber.d("onDescriptorWrite: $status (0 means success)")
+
+            mIsSending = false
+            if (mDataWriteQueue.size > 0) {
+                write(mDataWriteQueue.pop())
+            }
+        }
+
+        @Deprecated("Deprecated in Java")
+        override fun onCharacteristicChanged(
+            gatt: BluetoothGatt?,
+            characteristic: BluetoothGattCharacteristic?
+        ) {
+            val uuid = characteristic?.uuid?.toString() ?: return
+            if (uuid == BleCharacteristics.CHA_TELEMETRY) {
+                logTelemetry(characteristic.value ?: return)
+                return
+            }
+
+            val value = characteristic.value?.toString(Charsets.UTF_8) ?: return
+            Timber.d("onCharacteristicChanged: $uuid=$value")
+
+            if (uuid == BleCharacteristics.CHA_NAV_SYNC && value.startsWith("resync=")) {
+                // The device lost a delta, send everything again
+                mLastSentNavigation.clear()
+                sendToDevice(mLastNavigationData)
+            }
+
+            if (uuid == BleCharacteristics.CHA_NAV_SYNC && value.startsWith("shown=")) {
+                logLatency(fromKeyValString(value))
+            }
+
+            if (uuid == BleCharacteristics.CHA_NAV_TBT_ICON_ACK) {
+                onIconAck(fromKeyValString(value))
+            }
+        }
+    }
+
+    // Device time covers the queue, parsing, rendering and SPI, the rest is BLE both ways
+    private fun logLatency(kv: Map<String, String>) {
+        val sent = kv["ts"]?.toLongOrNull() ?: return
+        val deviceMs = (kv["device_us"]?.toLongOrNull() ?: return) / 1000
+        val totalMs = SystemClock.elapsedRealtime() - sent
+
+        Timber.d("Update ${kv["shown"]} on screen after ${totalMs}ms (device ${deviceMs}ms, BLE ${totalMs - deviceMs}ms)")
+    }
+
+    // See Telemetry::Record in the firmware
+    private fun logTelemetry(data: ByteArray) {
+        val version = data.getOrNull(0)?.toInt() ?: 0
+        if (data.size < 44 || version !in 1..3) {
+            Timber.w("Unknown telemetry record (${data.size}B)")
+            return
+        }
+
+        val buffer = ByteBuffer.wrap(data).order(ByteOrder.LITTLE_ENDIAN)
+        val queueDepth = buffer.get(1).toInt() and 0xFF
+        val frames = buffer.getShort(2).toInt() and 0xFFFF
+        val flushAvg = buffer.getInt(8)
+        val flushMax = buffer.getInt(12)
+        val coalesced = buffer.getInt(16)
+        val dropped = buffer.getInt(20)
+        val freeHeap = buffer.getInt(24)
+        val largestBlock = buffer.getInt(28)
+        val lvglFree = buffer.getInt(32)
+        val lvglUsed = buffer.get(36).toInt() and 0xFF
+        val lvglFrag = buffer.get(37).toInt() and 0xFF
+        val loopAvg = buffer.getShort(38).toInt() and 0xFFFF
+        val loopJitter = buffer.getInt(40)
+        val unknownKeys = if (version >= 2 && data.size >= 48) buffer.getInt(44) else 0
+        val hasIconCache = version >= 3 && data.size >= 60
+        val iconHits = if (hasIconCache) buffer.getInt(48) else 0
+        val iconMisses = if (hasIconCache) buffer.getInt(52) else 0
+        val iconEvictions = if (hasIconCache) buffer.getInt(56) else 0
+
+        Timber.d(
+            "Telemetry: fps=$frames flush=${flushAvg}/${flushMax}us queue=$queueDepth " +
+                "coalesced=$coalesced dropped=$dropped heap=$freeHeap/$largestBlock " +
+                "lvgl=$lvglFree ($lvglUsed% used, $lvglFrag% frag) loop=${loopAvg}us jitter=${loopJitter}us " +
+                "unknownKeys=$unknownKeys icons=$iconHits/$iconMisses hit/miss ($iconEvictions evicted)"
+        )
+    }
+
+    private fun subscribe(uuid: String) {
+        write(QueueItem(uuid, byteArrayOf(), false, Operation.SUBSCRIBE))
+    }
+
+    private fun read(uuid: String) {
+        write(QueueItem(uuid, byteArrayOf(), false, Operation.READ))
     }
 
     private fun write(item: QueueItem) {
@@ -311,6 +467,24 @@ class BleService : Service(), LocationListener {
                 return
             }
 
+            if (item.operation == Operation.READ) {
+                it.readCharacteristic(ch)
+                return
+            }
+
+            if (item.operation == Operation.SUBSCRIBE) {
+                it.setCharacteristicNotification(ch, true)
+                val descriptor = ch.getDescriptor(UUID.fromString(BleCharacteristics.CCCD_UUID))
+                if (descriptor == null) {
+                    Timber.e("${item.uuid} does not support notifications")
+                    mIsSending = false
+                    return
+                }
+                descriptor.value = BluetoothGattDescriptor.ENABLE_NOTIFICATION_VALUE
+                it.writeDescriptor(descriptor)
+                return
+            }
+
             ch.value = item.data
             it.writeCharacteristic(ch)
         }
@@ -390,6 +564,7 @@ class BleService : Service(), LocationListener {
         )
     }
 
+    @Synchronized
     fun sendToDevice(data: NavigationData?) {
         fun sanitize(str: String): String {
             // Remove non-breaking space
@@ -398,14 +573,26 @@ class BleService : Service(), LocationListener {
 
         val bitmap = data?.actionIcon?.bitmap
 
+        val helper = BitmapHelper()
+        val iconFormat = when {
+            bitmap == null -> ICON_FORMAT_1BPP
+            deviceDecodesIndexed() && helper.isColored(bitmap) -> ICON_FORMAT_I4
+            deviceDecodesGray2() -> ICON_FORMAT_2BPP
+            else -> ICON_FORMAT_1BPP
+        }
+
         var compressed: ByteArray? = bitmap?.let {
-            val helper = BitmapHelper()
-            helper.toBlackAndWhiteBuffer(
-                helper.compressBitmap(
-                    bitmap,
-                    Size(64, 62)
-                )
-            )
+            when (iconFormat) {
+                ICON_FORMAT_I4 -> helper.toIndexed4Buffer(bitmap, Size(ICON_SIZE, ICON_SIZE))
+                ICON_FORMAT_2BPP -> helper.toGray2Buffer(bitmap, Size(ICON_SIZE, ICON_SIZE))
+                else ->
+                    helper.toBlackAndWhiteBuffer(
+                        helper.compressBitmap(
+                            bitmap,
+                            Size(ICON_SIZE, ICON_SIZE)
+                        )
+                    )
+            }
         }
 
         var iconHash = ""
@@ -414,6 +601,16 @@ class BleService : Service(), LocationListener {
             iconHash = iconHash.substring(iconHash.length - 10, iconHash.length)
         }
 
+        // Google Maps only shows the current step, the icons seen most so far are the likely next ones
+        if (iconHash != "" && mLastSentNavigation["iconHash"] != iconHash) {
+            mIconCounts[iconHash] = (mIconCounts[iconHash] ?: 0) + 1
+        }
+        val nextIcons = mIconCounts.entries
+            .filter { it.key != iconHash }
+            .sortedByDescending { it.value }
+            .take(UPCOMING_ICON_COUNT)
+            .joinToString(",") { it.key }
+
         val map = mapOf(
             "nextRd" to sanitize(data?.nextDirection?.nextRoad ?: ""),
             "nextRdDesc" to sanitize(data?.nextDirection?.nextRoadAdditionalInfo ?: ""),
@@ -421,21 +618,40 @@ class BleService : Service(), LocationListener {
             "totalDist" to sanitize(data?.eta?.distance ?: ""),
             "eta" to sanitize(data?.eta?.eta ?: ""),
             "ete" to sanitize(data?.eta?.ete ?: ""),
-            "iconHash" to (iconHash)
+            "iconHash" to (iconHash),
+            "nextIcons" to nextIcons
         )
 
-        write(QueueItem(BleCharacteristics.CHA_NAV, toKeyValString(map).toByteArray()))
+        // Only send the fields that changed, the device keeps the rest
+        val full = mLastSentNavigation.isEmpty()
+        val delta = linkedMapOf("seq" to mNavigationSeq.toString())
+        if (full) {
+            delta["full"] = "1"
+        }
+        // Echoed back by the device once the update is on screen
+        delta["ts"] = SystemClock.elapsedRealtime().toString()
+        for ((key, value) in map) {
+            if (full || mLastSentNavigation[key] != value) {
+                delta[key] = value
+            }
+        }
+        mNavigationSeq = (mNavigationSeq + 1) and 0xFFFF
+        mLastSentNavigation.putAll(map)
+
+        // Deltas must not replace each other in the queue, the device would see a gap
+        write(QueueItem(BleCharacteristics.CHA_NAV, toKeyValString(delta).toByteArray(), false))
 
         // Only send once
         if (iconHash != "" && compressed != null && !mIconMap.containsKey(iconHash)) {
             if (mConnectionState == BluetoothProfile.STATE_CONNECTED) {
                 // Store the bitmap for later use
                 mIconMap[iconHash] = compressed
+                mIconFormats[iconHash] = iconFormat
 
-                compressed.let {
-                    val withIconHash = ("$iconHash;").toByteArray()
-                    Timber.w("it size: ${it.size}")
-                    write(QueueItem(BleCharacteristics.CHA_NAV_TBT_ICON, withIconHash + it, true))
+                if (deviceHasIcon(iconHash)) {
+                    Timber.i("Icon $iconHash already cached on the device")
+                } else {
+                    sendIconHeader(iconHash, compressed, iconFormat)
                 }
             }
         } else {
@@ -443,6 +659,104 @@ class BleService : Service(), LocationListener {
         }
     }
 
+    private fun sendIconHeader(iconHash: String, bitmap: ByteArray, iconFormat: Int) {
+        // PackBits unless it does not help, only the indices of an I4 icon are packed
+        val headerSize = if (iconFormat == ICON_FORMAT_I4) INDEXED_HEADER_SIZE else 0
+        val pixels = bitmap.copyOfRange(headerSize, bitmap.size)
+        val packed = BitmapHelper().packBits(pixels)
+        val usePacked = packed.size < pixels.size
+        val format = (iconFormat + (if (usePacked) 1 else 0)).toByte()
+        val icon = if (usePacked) bitmap.copyOfRange(0, headerSize) + packed else bitmap
+        Timber.d("Icon $iconHash: ${bitmap.size} -> ${icon.size} bytes")
+
+        mIconTransfers[iconHash] = icon
+
+        val crc = CRC32().apply { update(icon) }.value
+        val hash = iconHash.toByteArray()
+        val header = byteArrayOf(0x01, hash.size.toByte()) + hash +
+                leBytes(icon.size.toLong(), 2) + leBytes(crc, 4) + byteArrayOf(format)
+
+        // A new header replaces whatever icon was still queued, the device can resume that one later
+        write(QueueItem(BleCharacteristics.CHA_NAV_TBT_ICON, header, true))
+    }
+
+    // Manifest version 2 and up: the device decodes anti-aliased 2-bpp icons
+    private fun deviceDecodesGray2(): Boolean {
+        val manifest = mDeviceIconManifest ?: return false
+        return manifest.isNotEmpty() && manifest[0].toInt() >= 2
+    }
+
+    // Manifest version 3 and up: the device decodes palette-indexed colour icons
+    private fun deviceDecodesIndexed(): Boolean {
+        val manifest = mDeviceIconManifest ?: return false
+        return manifest.isNotEmpty() && manifest[0].toInt() >= 3
+    }
+
+    private fun deviceIconCount(): Int {
+        val manifest = mDeviceIconManifest ?: return 0
+        if (manifest.size < 4) return 0
+        return (manifest[2].toInt() and 0xFF) or ((manifest[3].toInt() and 0xFF) shl 8)
+    }
+
+    /**
+     * Check the device icon manifest: [version][hash count][icon count u16][bloom filter bits]
+     * May return a false positive, the device asks for the icon again in that case.
+     */
+    private fun deviceHasIcon(iconHash: String): Boolean {
+        val manifest = mDeviceIconManifest ?: return false
+        if (manifest.size <= 4 || manifest[0].toInt() !in 1..3) return false
+
+        val key = iconHash.toLongOrNull(16) ?: return false
+        val filterBits = (manifest.size - 4) * 8
+        for (i in 0 until manifest[1].toInt()) {
+            val bit = ((key shr (13 * i)) and 0x1FFF).toInt() % filterBits
+            if ((manifest[4 + bit / 8].toInt() and (1 shl (bit % 8))) == 0) {
+                return false
+            }
+        }
+        return true
+    }
+
+    private fun onIconAck(ack: Map<String, String>) {
+        val iconHash = ack["icon"] ?: return
+
+        if (ack["missing"] != null) {
+            // Asked ahead of time, the icon on screen goes first
+            if (ack["prefetch"] != null && mIconTransfers.isNotEmpty()) {
+                return
+            }
+            // Not cached on the device after all, unless it is on its way already
+            if (!mIconTransfers.containsKey(iconHash)) {
+                mIconMap[iconHash]?.let { sendIconHeader(iconHash, it, mIconFormats[iconHash] ?: ICON_FORMAT_1BPP) }
+            }
+            return
+        }
+
+        val offset = ack["offset"]?.toIntOrNull() ?: return
+
+        if (ack["done"] != null) {
+            Timber.i("Icon $iconHash transferred")
+            mIconTransfers.remove(iconHash)
+            return
+        }
+
+        val icon = mIconTransfers[iconHash] ?: return
+
+        // ATT write header is 3 bytes, chunk header is 3 bytes
+        val chunkSize = mMtu - 3 - 3
+        var position = offset
+        while (position < icon.size) {
+            val end = minOf(position + chunkSize, icon.size)
+            val chunk = byteArrayOf(0x02) + leBytes(position.toLong(), 2) + icon.copyOfRange(position, end)
+            write(QueueItem(BleCharacteristics.CHA_NAV_TBT_ICON, chunk, false))
+            position = end
+        }
+    }
+
+    private fun leBytes(value: Long, size: Int): ByteArray {
+        return ByteArray(size) { i -> (value shr (8 * i)).toByte() }
+    }
+
     private fun md5(s: ByteArray): String {
         return try {
             // Create MD5 Hash
@@ -577,5 +891,10 @@ class BleService : Service(), LocationListener {
         return result
     }
 
-
+    fun fromKeyValString(str: String): Map<String, String> {
+        return str.split("\n").mapNotNull {
+            val parts = it.split("=", limit = 2)
+            if (parts.size == 2) parts[0] to parts[1] else null
+        }.toMap()
+    }
 }
\ No newline at end of file
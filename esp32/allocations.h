@@ -0,0 +1,174 @@
+#ifndef ALLOCATIONS_H
+#define ALLOCATIONS_H
+
+#include "scheduler.h"
+
+/**
+ * Heap allocation tracking, off by default. Enable it with these extra build flags:
+ *   -DTRACK_ALLOCATIONS -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc -Wl,--wrap=free
+ * e.g. arduino-cli compile --build-property "build.extra_flags=..." (lv_conf.h then also routes
+ * lv_malloc through malloc).
+ *
+ * Allocations made by the loop task are counted under the tag of the innermost ALLOCATION_SCOPE,
+ * those of other tasks (BLE stack, timers) under "other". After init() a per-second rate is printed.
+ * A strict scope reports every allocation made inside it, and aborts when built with
+ * -DALLOCATION_ASSERT: processing a navigation packet is expected not to allocate.
+ */
+#ifdef TRACK_ALLOCATIONS
+
+#include <atomic>
+
+namespace Allocations {
+	namespace detail {
+		constexpr uint8_t MAX_TAGS = 16;
+		constexpr uint8_t NO_TAG   = 0; // loop code outside any scope
+
+		struct Tag {
+			const char* name;
+			uint32_t allocations;
+			uint32_t bytes;
+		};
+
+		Tag tags[MAX_TAGS]    = {{"loop", 0, 0}};
+		uint8_t tagCount      = 1;
+		uint8_t currentTag    = NO_TAG;
+		TaskHandle_t loopTask = nullptr;
+
+		std::atomic<uint32_t> otherAllocations{0};
+		std::atomic<uint32_t> otherBytes{0};
+		std::atomic<uint32_t> frees{0};
+
+		// Last report, to print rates
+		uint32_t lastTotal[MAX_TAGS] = {};
+		uint32_t lastOther           = 0;
+		uint32_t lastFrees           = 0;
+
+		// Called from the malloc wrappers, must not allocate
+		void count(size_t size) {
+			if (!loopTask || xTaskGetCurrentTaskHandle() != loopTask) {
+				otherAllocations.fetch_add(1, std::memory_order_relaxed);
+				otherBytes.fetch_add(size, std::memory_order_relaxed);
+				return;
+			}
+
+			tags[currentTag].allocations++;
+			tags[currentTag].bytes += size;
+		}
+
+		uint8_t tagOf(const char* name) {
+			for (uint8_t i = 0; i < tagCount; i++) {
+				if (tags[i].name == name)
+					return i;
+			}
+
+			if (tagCount == MAX_TAGS)
+				return NO_TAG;
+
+			tags[tagCount].name = name;
+			return tagCount++;
+		}
+	} // namespace detail
+
+	class Scope {
+	  public:
+		Scope(const char* name, bool strict = false)
+		    : _previous(detail::currentTag), _tag(detail::tagOf(name)), _strict(strict),
+		      _allocations(detail::tags[_tag].allocations) {
+			detail::currentTag = _tag;
+		}
+
+		~Scope() {
+			detail::currentTag = _previous;
+
+			const auto allocations = detail::tags[_tag].allocations - _allocations;
+			if (!_strict || allocations == 0)
+				return;
+
+			Serial.printf("%lu unexpected allocation(s) in %s\n", allocations, detail::tags[_tag].name);
+#ifdef ALLOCATION_ASSERT
+			abort();
+#endif
+		}
+
+	  private:
+		uint8_t _previous;
+		uint8_t _tag;
+		bool _strict;
+		uint32_t _allocations;
+	};
+
+	// Allocations before this are expected (setup), the loop task is the one calling it
+	void init() {
+		detail::loopTask  = xTaskGetCurrentTaskHandle();
+		detail::lastOther = detail::otherAllocations;
+		detail::lastFrees = detail::frees;
+		for (uint8_t i = 0; i < detail::tagCount; i++)
+			detail::lastTotal[i] = detail::tags[i].allocations;
+	}
+
+	void update() {
+		using namespace detail;
+
+		DO_EVERY(1000) {
+			const uint32_t other     = otherAllocations;
+			const uint32_t freeCount = frees;
+
+			Serial.printf("Allocations/s: other %lu, frees %lu", other - lastOther, freeCount - lastFrees);
+			lastOther = other;
+			lastFrees = freeCount;
+
+			for (uint8_t i = 0; i < tagCount; i++) {
+				const auto allocations = tags[i].allocations - lastTotal[i];
+				if (allocations)
+					Serial.printf(", %s %lu", tags[i].name, allocations);
+				lastTotal[i] = tags[i].allocations;
+			}
+			Serial.println();
+		}
+	}
+} // namespace Allocations
+
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* pointer, size_t size);
+void __real_free(void* pointer);
+
+void* __wrap_malloc(size_t size) {
+	Allocations::detail::count(size);
+	return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+	Allocations::detail::count(count * size);
+	return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* pointer, size_t size) {
+	Allocations::detail::count(size);
+	return __real_realloc(pointer, size);
+}
+
+void __wrap_free(void* pointer) {
+	if (pointer)
+		Allocations::detail::frees.fetch_add(1, std::memory_order_relaxed);
+	__real_free(pointer);
+}
+}
+
+#define ALLOCATION_SCOPE(name)        Allocations::Scope TOKENPASTE2(allocationScope_, __LINE__)(name)
+#define ALLOCATION_STRICT_SCOPE(name) Allocations::Scope TOKENPASTE2(allocationScope_, __LINE__)(name, true)
+
+#else
+
+namespace Allocations {
+	void init() {}
+	void update() {}
+} // namespace Allocations
+
+#define ALLOCATION_SCOPE(name)
+#define ALLOCATION_STRICT_SCOPE(name)
+
+#endif // TRACK_ALLOCATIONS
+
+#endif // ALLOCATIONS_H
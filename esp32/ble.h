@@ -8,18 +8,27 @@
 #include <BLESecurity.h>
 #include <BLEServer.h>
 #include <BLEUtils.h>
+#include <atomic>
 #include <vector>
 
 BLEServer* pServer      = NULL;
 bool deviceConnected    = false;
 bool oldDeviceConnected = false;
-
-#define SERVICE_UUID          "ec91d7ab-e87c-48d5-adfa-cc4b2951298a"
-#define CHA_SETTINGS          "9d37a346-63d3-4df6-8eee-f0242949f59f"
-#define CHA_NAV               "0b11deef-1563-447f-aece-d3dfeb1c1f20"
-#define CHA_NAV_TBT_ICON      "d4d8fcca-16b2-4b8e-8ed5-90137c44a8ad"
-#define CHA_NAV_TBT_ICON_DESC "d63a466e-5271-4a5d-a942-a34ccdb013d9"
-#define CHA_GPS_SPEED         "98b6073a-5cf3-4e73-b6d3-f8e05fa018a9"
+esp_bd_addr_t peerAddress{};
+std::atomic<uint16_t> peerMtu{ESP_GATT_DEF_BLE_MTU_SIZE}; // negotiated with the phone, 23 until it asks
+
+#define SERVICE_UUID              "ec91d7ab-e87c-48d5-adfa-cc4b2951298a"
+#define CHA_SETTINGS              "9d37a346-63d3-4df6-8eee-f0242949f59f"
+#define CHA_NAV                   "0b11deef-1563-447f-aece-d3dfeb1c1f20"
+#define CHA_NAV_TBT_ICON          "d4d8fcca-16b2-4b8e-8ed5-90137c44a8ad"
+#define CHA_NAV_TBT_ICON_DESC     "d63a466e-5271-4a5d-a942-a34ccdb013d9"
+#define CHA_GPS_SPEED             "98b6073a-5cf3-4e73-b6d3-f8e05fa018a9"
+#define CHA_NAV_SYNC              "5b0c3a2e-8f6d-4b1a-9c47-2e1f6a8d3b90"
+#define CHA_NAV_TBT_ICON_ACK      "7e2d9f41-3c58-4a06-b1e3-94d2c7a05f6b"
+#define CHA_NAV_TBT_ICON_MANIFEST "c3a8e5f2-6d14-4b97-8e0a-5f29b6d4c1e7"
+#define CHA_THROUGHPUT            "e1f4b7c2-9a35-4d68-b0e2-7c5a9f1d3e84"
+#define CHA_TELEMETRY             "2f8b6d1e-4c7a-4e53-9b20-d6e8a3f5c719"
+#define CHA_MEMORY_REPORT         "8a3e5c71-d29b-4f06-a4e8-61b7c0d3f925"
 
 // typedef void (*OnCharacteristicWriteCallback)(const String& uuid, uint8_t* data, size_t length);
 // typedef void (*OnConnectionChangeCallback)(bool connected);
@@ -35,7 +44,8 @@ void onConnectionChange(bool connected);
 struct CharacteristicConfig {
 	String name;
 	String uuid;
-	// const uint32_t types;
+	uint32_t properties                  = BLECharacteristic::PROPERTY_WRITE;
+	bool quiet                           = false; // don't log writes
 	BLECharacteristic* bleCharacteristic = nullptr;
 };
 
@@ -87,6 +97,16 @@ class ServerCallbacks : public BLEServerCallbacks {
 		onConnectionChange(deviceConnected);
 	};
 
+	void onConnect(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) {
+		memcpy(peerAddress, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+		peerMtu = ESP_GATT_DEF_BLE_MTU_SIZE;
+	}
+
+	void onMtuChanged(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) {
+		Serial.printf("MTU changed: %u\n", param->mtu.mtu);
+		peerMtu = param->mtu.mtu;
+	}
+
 	void onDisconnect(BLEServer* pServer) {
 		Serial.println("Device disconnected, start advertising...");
 		deviceConnected = false;
@@ -103,6 +123,12 @@ class CharacteristicWriteCallbacks : public BLECharacteristicCallbacks {
 		if (!characteristicInfo) {
 			Serial.print("Error: No characteristic found with UUID: ");
 			Serial.println(uuid);
+			return;
+		}
+
+		if (characteristicInfo->quiet) {
+			onCharacteristicWrite(uuid, pCharacteristic->getData(), pCharacteristic->getLength());
+			return;
 		}
 
 		Serial.print(characteristicInfo->name);
@@ -113,7 +139,8 @@ class CharacteristicWriteCallbacks : public BLECharacteristicCallbacks {
 			Serial.print(pCharacteristic->getLength());
 			Serial.println("B>");
 		} else {
-			Serial.println(pCharacteristic->getValue());
+			Serial.write(pCharacteristic->getData(), pCharacteristic->getLength());
+			Serial.println();
 		}
 
 		onCharacteristicWrite(uuid, pCharacteristic->getData(), pCharacteristic->getLength());
@@ -142,6 +169,38 @@ void initBle() {
 	.name = "GPS_SPEED",
 	.uuid = CHA_GPS_SPEED,
 	});
+	catDriveService.characteristics.push_back(CharacteristicConfig{
+	.name       = "NAV_SYNC",
+	.uuid       = CHA_NAV_SYNC,
+	.properties = BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY,
+	});
+	catDriveService.characteristics.push_back(CharacteristicConfig{
+	.name       = "NAV_ICON_ACK",
+	.uuid       = CHA_NAV_TBT_ICON_ACK,
+	.properties = BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY,
+	});
+	catDriveService.characteristics.push_back(CharacteristicConfig{
+	.name       = "NAV_ICON_MANIFEST",
+	.uuid       = CHA_NAV_TBT_ICON_MANIFEST,
+	.properties = BLECharacteristic::PROPERTY_READ,
+	});
+	catDriveService.characteristics.push_back(CharacteristicConfig{
+	.name       = "THROUGHPUT",
+	.uuid       = CHA_THROUGHPUT,
+	.properties = BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_WRITE_NR |
+	              BLECharacteristic::PROPERTY_NOTIFY,
+	.quiet      = true,
+	});
+	catDriveService.characteristics.push_back(CharacteristicConfig{
+	.name       = "TELEMETRY",
+	.uuid       = CHA_TELEMETRY,
+	.properties = BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY,
+	});
+	catDriveService.characteristics.push_back(CharacteristicConfig{
+	.name       = "MEMORY_REPORT",
+	.uuid       = CHA_MEMORY_REPORT,
+	.properties = BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY,
+	});
 
 	// Create the BLE Device
 	BLEDevice::init("CatDrive");
@@ -160,11 +219,17 @@ void initBle() {
 		serviceConfig.bleService = server.bleServer->createService(serviceConfig.uuid, 4 * serviceConfig.characteristics.size());
 
 		for (auto& characteristicConfig : serviceConfig.characteristics) {
-			const auto property = BLECharacteristic::PROPERTY_WRITE;
+			const auto property = characteristicConfig.properties;
 
 			characteristicConfig.bleCharacteristic =
 			serviceConfig.bleService->createCharacteristic(characteristicConfig.uuid, property);
-			characteristicConfig.bleCharacteristic->setCallbacks(writeCallbacks);
+
+			if (property & BLECharacteristic::PROPERTY_WRITE)
+				characteristicConfig.bleCharacteristic->setCallbacks(writeCallbacks);
+
+			// Client Characteristic Configuration, lets the phone subscribe to notifications
+			if (property & BLECharacteristic::PROPERTY_NOTIFY)
+				characteristicConfig.bleCharacteristic->addDescriptor(new BLE2902());
 
 			const auto desc = new BLE2901();
 			desc->setDescription(characteristicConfig.name);
@@ -178,15 +243,32 @@ void initBle() {
 }
 
 void notifyCharacteristic(const String& uuid, uint8_t* data, size_t length) {
-	const auto pCharacteristic = server.findCharacteristicByUuid(uuid)->bleCharacteristic;
-	if (!pCharacteristic) {
+	const auto characteristicInfo = server.findCharacteristicByUuid(uuid);
+	if (!characteristicInfo || !characteristicInfo->bleCharacteristic) {
 		Serial.print("Error: No characteristic found with UUID: ");
 		Serial.println(uuid);
 		return;
 	}
 
+	if (!deviceConnected)
+		return;
+
+	const auto pCharacteristic = characteristicInfo->bleCharacteristic;
+
 	pCharacteristic->setValue(data, length);
 	pCharacteristic->notify();
 }
 
+// Value returned to the phone on read
+void setCharacteristicValue(const String& uuid, uint8_t* data, size_t length) {
+	const auto characteristicInfo = server.findCharacteristicByUuid(uuid);
+	if (!characteristicInfo || !characteristicInfo->bleCharacteristic) {
+		Serial.print("Error: No characteristic found with UUID: ");
+		Serial.println(uuid);
+		return;
+	}
+
+	characteristicInfo->bleCharacteristic->setValue(data, length);
+}
+
 #endif // BLE_H
\ No newline at end of file
@@ -0,0 +1,360 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "ble.h"
+#include "memreport.h"
+#include "telemetry.h"
+
+#include "flashfs.h"
+
+#include <atomic>
+
+// The handling of a characteristic write behind onCharacteristicWrite(), see esp32.ino
+void applyWrite(const String& uuid, uint8_t* data, size_t length);
+
+/**
+ * Record and replay of the BLE ingest traffic, to turn a recorded ride into a repeatable benchmark.
+ *
+ * While capturing, every navigation, icon and speed write is appended as
+ * [stream u8][time ms u32][length u16][payload] to a log on FLASH_FS. The log is bounded: it is split
+ * in two files of FILE_MAX_SIZE, the older one is dropped when the newer one is full.
+ *
+ * Replay feeds the log back through applyWrite() from the loop, with the original timing divided by
+ * `speed` (0 = as fast as the loop goes). Live writes to the recorded streams are dropped meanwhile,
+ * so the queues they fill keep one producer (see LiveWrite). At the end, frames, flush time, max
+ * queue depth and coalesced/dropped updates over the replay are printed.
+ *
+ * Controlled from the settings characteristic: capture=start|stop, replay=<speed>|stop. The BLE task
+ * only queues the command with request(), update() applies it in the loop, which owns the log files
+ * and the replay state.
+ */
+namespace Capture {
+	enum Command : uint8_t {
+		COMMAND_NONE,
+		COMMAND_START_CAPTURE,
+		COMMAND_STOP_CAPTURE,
+		COMMAND_START_REPLAY,
+		COMMAND_STOP_REPLAY,
+	};
+
+	namespace detail {
+		constexpr const char* STREAM_UUIDS[] = {CHA_NAV, CHA_NAV_TBT_ICON, CHA_GPS_SPEED};
+		constexpr uint8_t STREAM_COUNT       = sizeof(STREAM_UUIDS) / sizeof(STREAM_UUIDS[0]);
+		constexpr uint8_t NO_STREAM          = 0xFF;
+
+		constexpr const char* FILES[2]     = {"/capture0.log", "/capture1.log"};
+		constexpr size_t FILE_MAX_SIZE     = 128 * 1024;
+		constexpr size_t HEADER_SIZE       = 7;
+		constexpr size_t STAGING_SIZE      = 4096;
+		constexpr size_t RECORD_MAX_SIZE   = 600;
+		constexpr uint8_t MAX_REPLAY_BURST = 8; // records dispatched per loop
+		constexpr uint32_t FLUSH_PERIOD_ms = 1000;
+
+		// Filled by the BLE task, written to flash from the loop
+		uint8_t staging[STAGING_SIZE];
+		uint8_t pending[STAGING_SIZE]; // staging copy being written
+		size_t stagingLength     = 0;
+		uint32_t overflows       = 0;
+		portMUX_TYPE stagingLock = portMUX_INITIALIZER_UNLOCKED;
+		const MemoryReport::Registration stagingRegistration{"captureStaging", sizeof(staging) + sizeof(pending)};
+
+		// Command | speed << 8, the last one requested wins
+		std::atomic<uint16_t> requested{COMMAND_NONE};
+
+		// Set by the loop, read by the BLE task in LiveWrite
+		std::atomic<bool> capturing{false};
+		uint8_t currentFile   = 0;
+		size_t currentSize    = 0;
+		uint32_t lastFlush_ms = 0;
+
+		// replaying is set before the replay dispatches, liveWriting before a live write checks it:
+		// either the write sees the replay and is dropped, or the replay waits for it to end
+		std::atomic<bool> replaying{false};
+		std::atomic<bool> liveWriting{false};
+		uint8_t replaySpeed      = 1;
+		uint8_t replayOrder[2]   = {0, 1};
+		uint8_t replayFile       = 0; // index in replayOrder
+		File replayLog;
+		uint32_t replayStart_ms  = 0;
+		uint32_t firstRecord_ms  = 0;
+		uint32_t replayedRecords = 0;
+		size_t maxQueueDepth     = 0;
+		Telemetry::Totals replayStartTotals{};
+
+		// Next record, read ahead so its time can be waited for
+		uint8_t record[RECORD_MAX_SIZE];
+		uint8_t recordStream  = NO_STREAM;
+		uint32_t record_ms    = 0;
+		uint16_t recordLength = 0;
+		const MemoryReport::Registration recordRegistration{"captureRecord", sizeof(record)};
+
+		uint8_t streamOf(const String& uuid) {
+			for (uint8_t i = 0; i < STREAM_COUNT; i++) {
+				if (uuid == STREAM_UUIDS[i])
+					return i;
+			}
+			return NO_STREAM;
+		}
+
+		void flushStaging() {
+			lastFlush_ms = millis();
+
+			portENTER_CRITICAL(&stagingLock);
+			const size_t length = stagingLength;
+			memcpy(pending, staging, length);
+			stagingLength = 0;
+			portEXIT_CRITICAL(&stagingLock);
+
+			if (length == 0)
+				return;
+
+			if (currentSize + length > FILE_MAX_SIZE) {
+				currentFile = 1 - currentFile;
+				currentSize = 0;
+				FLASH_FS.remove(FILES[currentFile]);
+			}
+
+			File file = FLASH_FS.open(FILES[currentFile], FILE_APPEND);
+			if (!file)
+				return;
+			currentSize += file.write(pending, length);
+			file.close();
+		}
+
+		// Time of the first record in a file, the log may come from before a reboot
+		uint32_t firstRecordTime(uint8_t index) {
+			uint8_t header[HEADER_SIZE];
+
+			File file = FLASH_FS.open(FILES[index], FILE_READ);
+			if (!file)
+				return UINT32_MAX;
+
+			const auto length = file.read(header, HEADER_SIZE);
+			file.close();
+			if (length != HEADER_SIZE)
+				return UINT32_MAX;
+
+			return header[1] | header[2] << 8 | header[3] << 16 | (uint32_t)header[4] << 24;
+		}
+
+		bool openReplayFile(uint8_t index) {
+			replayFile = index;
+			replayLog  = FLASH_FS.open(FILES[replayOrder[index]], FILE_READ);
+			return replayLog && replayLog.size() > 0;
+		}
+
+		bool readRecord() {
+			uint8_t header[HEADER_SIZE];
+
+			while (replayLog.read(header, HEADER_SIZE) != HEADER_SIZE) {
+				replayLog.close();
+				if (replayFile == 0 && openReplayFile(1))
+					continue;
+				return false;
+			}
+
+			recordStream = header[0];
+			record_ms    = header[1] | header[2] << 8 | header[3] << 16 | (uint32_t)header[4] << 24;
+			recordLength = header[5] | header[6] << 8;
+
+			if (recordStream >= STREAM_COUNT || recordLength > RECORD_MAX_SIZE - 1)
+				return false;
+
+			if (replayLog.read(record, recordLength) != recordLength)
+				return false;
+			// Text payloads are read as C strings on the ingest path
+			record[recordLength] = 0;
+			return true;
+		}
+
+		void report() {
+			const auto totals = Telemetry::totals();
+			const auto frames = totals.frames - replayStartTotals.frames;
+
+			Serial.printf("Replay done: %lu records in %lums, %lu frames, flush avg %luus, "
+			              "max queue %u, coalesced %lu, dropped %lu\n",
+			              replayedRecords,
+			              millis() - replayStart_ms,
+			              frames,
+			              frames ? (uint32_t)((totals.flush_us - replayStartTotals.flush_us) / frames) : 0,
+			              maxQueueDepth,
+			              totals.coalesced - replayStartTotals.coalesced,
+			              totals.dropped - replayStartTotals.dropped);
+		}
+	} // namespace detail
+
+	bool isReplaying() {
+		return detail::replaying;
+	}
+
+	// From the BLE task, applied by the next update()
+	void request(Command command, uint8_t speed = 1) {
+		detail::requested = command | speed << 8;
+	}
+
+	void startCapture() {
+		using namespace detail;
+
+		if (replaying)
+			return;
+
+		FLASH_FS.remove(FILES[0]);
+		FLASH_FS.remove(FILES[1]);
+		currentFile = 0;
+		currentSize = 0;
+
+		portENTER_CRITICAL(&stagingLock);
+		stagingLength = 0;
+		overflows     = 0;
+		portEXIT_CRITICAL(&stagingLock);
+
+		capturing = true;
+		Serial.println("Capture started");
+	}
+
+	void stopCapture() {
+		using namespace detail;
+
+		if (!capturing)
+			return;
+
+		capturing = false;
+		flushStaging();
+		Serial.printf("Capture stopped, %u bytes, %lu records lost\n", currentSize, overflows);
+	}
+
+	void stopReplay() {
+		using namespace detail;
+
+		if (!replaying)
+			return;
+
+		replaying = false;
+		replayLog.close();
+		report();
+	}
+
+	void startReplay(uint8_t speed) {
+		using namespace detail;
+
+		stopCapture();
+		stopReplay();
+
+		// The older file goes first
+		const bool swapped = firstRecordTime(1) < firstRecordTime(0);
+		replayOrder[0]     = swapped ? 1 : 0;
+		replayOrder[1]     = swapped ? 0 : 1;
+
+		if (!openReplayFile(0) || !readRecord()) {
+			Serial.println("Nothing to replay");
+			return;
+		}
+
+		replaying         = true;
+		replaySpeed       = speed;
+		replayStart_ms    = millis();
+		firstRecord_ms    = record_ms;
+		replayedRecords   = 0;
+		maxQueueDepth     = 0;
+		replayStartTotals = Telemetry::totals();
+		Serial.printf("Replay started at %ux\n", speed);
+	}
+
+	// Held by the BLE task while it handles a characteristic write (one at a time), false if the
+	// write must be ignored. Writes to the recorded streams are appended to the capture.
+	class LiveWrite {
+	  public:
+		LiveWrite(const String& uuid, const uint8_t* data, size_t length) : _stream(detail::streamOf(uuid)) {
+			using namespace detail;
+
+			if (_stream == NO_STREAM) {
+				_accepted = true;
+				return;
+			}
+
+			liveWriting = true;
+			_accepted   = !replaying;
+			if (_accepted && capturing)
+				append(data, length);
+		}
+
+		~LiveWrite() {
+			if (_stream != detail::NO_STREAM)
+				detail::liveWriting = false;
+		}
+
+		explicit operator bool() const {
+			return _accepted;
+		}
+
+	  private:
+		void append(const uint8_t* data, size_t length) {
+			using namespace detail;
+
+			const auto now_ms = millis();
+			length            = std::min(length, RECORD_MAX_SIZE - 1);
+
+			portENTER_CRITICAL(&stagingLock);
+			if (stagingLength + HEADER_SIZE + length <= STAGING_SIZE) {
+				uint8_t* header = staging + stagingLength;
+				header[0]       = _stream;
+				header[1]       = now_ms;
+				header[2]       = now_ms >> 8;
+				header[3]       = now_ms >> 16;
+				header[4]       = now_ms >> 24;
+				header[5]       = length;
+				header[6]       = length >> 8;
+
+				memcpy(header + HEADER_SIZE, data, length);
+				stagingLength += HEADER_SIZE + length;
+			} else {
+				overflows++;
+			}
+			portEXIT_CRITICAL(&stagingLock);
+		}
+
+		const uint8_t _stream;
+		bool _accepted;
+	};
+
+	void update(size_t queueDepth) {
+		using namespace detail;
+
+		const uint16_t command = requested.exchange(COMMAND_NONE);
+		switch (command & 0xFF) {
+		case COMMAND_START_CAPTURE: startCapture(); break;
+		case COMMAND_STOP_CAPTURE: stopCapture(); break;
+		case COMMAND_START_REPLAY: startReplay(command >> 8); break;
+		case COMMAND_STOP_REPLAY: stopReplay(); break;
+		}
+
+		// Batched, each flash write stalls the loop
+		if (capturing && (stagingLength >= STAGING_SIZE / 2 || millis() - lastFlush_ms >= FLUSH_PERIOD_ms))
+			flushStaging();
+
+		if (!replaying)
+			return;
+
+		maxQueueDepth = std::max(maxQueueDepth, queueDepth);
+
+		for (uint8_t i = 0; i < MAX_REPLAY_BURST; i++) {
+			const auto due_ms = replaySpeed ? (record_ms - firstRecord_ms) / replaySpeed : 0;
+			if (millis() - replayStart_ms < due_ms)
+				return;
+
+			// A live write accepted before the replay started is still being handled
+			if (liveWriting)
+				return;
+
+			applyWrite(STREAM_UUIDS[recordStream], record, recordLength);
+			replayedRecords++;
+
+			if (!readRecord()) {
+				stopReplay();
+				return;
+			}
+		}
+	}
+} // namespace Capture
+
+#endif // CAPTURE_H
@@ -13,4 +13,12 @@
 
 #define HORIZONTAL
 
+// Cached icons: a log in a raw flash partition (ICON_STORE_PARTITION in partitions.csv, files on
+// SPIFFS without it), or files on SPIFFS or LittleFS. See iconstorage.h.
+#define ICON_STORAGE_RAW      1
+#define ICON_STORAGE_SPIFFS   2
+#define ICON_STORAGE_LITTLEFS 3
+#define ICON_STORAGE          ICON_STORAGE_RAW
+#define ICON_STORE_PARTITION  "icons"
+
 #endif
\ No newline at end of file
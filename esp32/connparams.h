@@ -0,0 +1,255 @@
+#ifndef CONNPARAMS_H
+#define CONNPARAMS_H
+
+#include "ble.h"
+#include "icontransfer.h"
+#include "latency.h"
+#include "ui.h"
+
+#include <esp_gap_ble_api.h>
+
+/**
+ * Device side connection parameter management.
+ *
+ * Short connection intervals are requested while a maneuver is close or an icon is in flight,
+ * long intervals with slave latency while cruising or idle. Moving to a faster regime is
+ * immediate, moving to a slower one only after it was wanted for HOLD_ms.
+ *
+ * On connect the link layer is also asked for 251 byte PDUs (data length extension) and LE 2M
+ * PHY. Either stays at its default (27 bytes, 1M) if the phone does not support it.
+ *
+ * The delivery latency of navigation updates (received -> flushed, see latency.h) is accumulated
+ * under the regime they arrived in and logged when the device leaves that regime.
+ */
+namespace ConnParams {
+	enum Regime : uint8_t { REGIME_IDLE, REGIME_CRUISE, REGIME_FAST, REGIME_COUNT, REGIME_NONE = REGIME_COUNT };
+
+	struct Params {
+		const char* name;
+		uint16_t minInterval; // 1.25 ms units
+		uint16_t maxInterval; // 1.25 ms units
+		uint16_t latency;     // connection events
+		uint16_t timeout;     // 10 ms units
+	};
+
+	struct Link {
+		uint16_t interval   = 0; // 1.25 ms units
+		uint16_t latency    = 0;
+		uint16_t timeout    = 0; // 10 ms units
+		uint16_t dataLength = 27;
+		uint8_t txPhy       = 1; // ESP_BLE_GAP_PHY_1M
+		uint8_t rxPhy       = 1;
+	};
+
+	namespace detail {
+		constexpr uint16_t MAX_DATA_LENGTH      = 251;
+		constexpr uint32_t FAST_DISTANCE_m      = 300;
+		constexpr uint32_t HOLD_ms              = 5000;
+		constexpr uint32_t MIN_REQUEST_INTERVAL = 1000;
+
+		constexpr Params PARAMS[REGIME_COUNT] = {
+		{"idle", 80, 160, 4, 600},  // 100-200 ms
+		{"cruise", 24, 40, 2, 400}, // 30-50 ms
+		{"fast", 6, 12, 0, 200},    // 7.5-15 ms
+		};
+
+		struct Stats {
+			uint32_t updates;
+			uint64_t total_us;
+			uint32_t max_us;
+		};
+
+		Regime current            = REGIME_NONE;
+		Regime wanted             = REGIME_NONE;
+		uint32_t wantedSince_ms   = 0;
+		uint32_t lastRequest_ms   = 0;
+		Stats stats[REGIME_COUNT] = {};
+		Link link{};
+
+		// "300 m", "1,2 km", "0.3 mi", "500 ft"; negative if unknown
+		float toMeters(const char* distance) {
+			if (!*distance)
+				return -1;
+
+			char number[NAV_SHORT_CAPACITY + 1];
+			snprintf(number, sizeof(number), "%s", distance);
+			for (char* c = number; *c; c++) {
+				if (*c == ',')
+					*c = '.';
+			}
+			const float value = strtof(number, nullptr);
+
+			if (strstr(distance, "km"))
+				return value * 1000;
+			if (strstr(distance, "mi"))
+				return value * 1609.34f;
+			if (strstr(distance, "ft"))
+				return value * 0.3048f;
+			return value;
+		}
+
+		Regime decide() {
+			if (IconTransfer::isReceiving())
+				return REGIME_FAST;
+
+			if (!Data::hasNavigationData())
+				return REGIME_IDLE;
+
+			const auto meters = toMeters(Data::details::distanceToNextTurn.c_str());
+			if (meters >= 0 && meters <= FAST_DISTANCE_m)
+				return REGIME_FAST;
+
+			return REGIME_CRUISE;
+		}
+
+		// Since boot, over every stay in `regime`
+		void report(Regime regime) {
+			const auto& stat = stats[regime];
+			if (stat.updates == 0)
+				return;
+
+			Serial.printf("Update latency in %s regime: avg %luus, max %luus over %lu updates\n",
+			              PARAMS[regime].name,
+			              (uint32_t)(stat.total_us / stat.updates),
+			              stat.max_us,
+			              stat.updates);
+		}
+
+		void request(Regime regime) {
+			const auto& params = PARAMS[regime];
+
+			if (current != REGIME_NONE)
+				report(current);
+
+			Serial.printf("Requesting %s connection: %u-%u x1.25ms, latency %u, timeout %u0ms\n",
+			              params.name,
+			              params.minInterval,
+			              params.maxInterval,
+			              params.latency,
+			              params.timeout);
+
+			server.bleServer->updateConnParams(
+			peerAddress, params.minInterval, params.maxInterval, params.latency, params.timeout);
+
+			current        = regime;
+			lastRequest_ms = millis();
+		}
+
+		// From Latency, in the loop
+		void onDelivered(uint32_t total_us) {
+			if (current == REGIME_NONE)
+				return;
+
+			auto& stat = stats[current];
+			stat.updates++;
+			stat.total_us += total_us;
+			stat.max_us = std::max(stat.max_us, total_us);
+		}
+	} // namespace detail
+
+	const Link& link() {
+		return detail::link;
+	}
+
+	// Log what the central actually agreed to
+	void onGapEvent(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param) {
+		auto& link = detail::link;
+
+		switch (event) {
+		case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT: {
+			const auto& update = param->update_conn_params;
+			if (update.status == ESP_BT_STATUS_SUCCESS) {
+				link.interval = update.conn_int;
+				link.latency  = update.latency;
+				link.timeout  = update.timeout;
+			}
+
+			Serial.printf("Connection params updated (status %d): "
+			              "interval %u.%02ums, latency %u, timeout %u0ms\n",
+			              update.status,
+			              update.conn_int * 125 / 100,
+			              update.conn_int * 125 % 100,
+			              update.latency,
+			              update.timeout);
+			break;
+		}
+		case ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT: {
+			const auto& result = param->pkt_data_length_cmpl;
+			if (result.status == ESP_BT_STATUS_SUCCESS)
+				link.dataLength = result.params.tx_len;
+
+			Serial.printf("Data length (status %d): tx %u, rx %u\n",
+			              result.status,
+			              result.params.tx_len,
+			              result.params.rx_len);
+			break;
+		}
+#ifdef CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+		case ESP_GAP_BLE_PHY_UPDATE_COMPLETE_EVT: {
+			const auto& result = param->phy_update;
+			if (result.status == ESP_BT_STATUS_SUCCESS) {
+				link.txPhy = result.tx_phy;
+				link.rxPhy = result.rx_phy;
+			}
+
+			// 1 = 1M, 2 = 2M, 3 = coded
+			Serial.printf("PHY update (status %d): tx %u, rx %u\n", result.status, result.tx_phy, result.rx_phy);
+			break;
+		}
+#endif
+		default: break;
+		}
+	}
+
+	// Ask for the fastest link the phone supports, it falls back on its own otherwise
+	void negotiateLink() {
+		detail::link = Link{};
+
+		if (esp_ble_gap_set_pkt_data_len(peerAddress, detail::MAX_DATA_LENGTH) != ESP_OK)
+			Serial.println("Data length extension request failed");
+
+#ifdef CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+		if (esp_ble_gap_set_preferred_phy(peerAddress,
+		                                  0, // preferences given for both directions
+		                                  ESP_BLE_GAP_PHY_1M_PREF_MASK | ESP_BLE_GAP_PHY_2M_PREF_MASK,
+		                                  ESP_BLE_GAP_PHY_1M_PREF_MASK | ESP_BLE_GAP_PHY_2M_PREF_MASK,
+		                                  ESP_BLE_GAP_PHY_OPTIONS_NO_PREF)
+		    != ESP_OK)
+			Serial.println("2M PHY request failed");
+#else
+		Serial.println("2M PHY not supported by this BLE stack, staying at 1M");
+#endif
+	}
+
+	void init() {
+		BLEDevice::setCustomGapHandler(onGapEvent);
+		Latency::setDeliveryCallback(detail::onDelivered);
+	}
+
+	// The central resets the parameters on every new connection
+	void reset() {
+		detail::current = REGIME_NONE;
+		detail::wanted  = REGIME_NONE;
+	}
+
+	void update() {
+		using namespace detail;
+
+		if (!deviceConnected)
+			return;
+
+		const auto regime = decide();
+		if (regime != wanted) {
+			wanted         = regime;
+			wantedSince_ms = millis();
+		}
+
+		if (wanted == current || millis() - lastRequest_ms < MIN_REQUEST_INTERVAL)
+			return;
+
+		if (current == REGIME_NONE || wanted > current || millis() - wantedSince_ms >= HOLD_ms)
+			request(wanted);
+	}
+} // namespace ConnParams
+
+#endif // CONNPARAMS_H
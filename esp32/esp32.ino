@@ -1,38 +1,111 @@
+#include "allocations.h"
 #include "ble.h"
+#include "capture.h"
 #include "config.h"
+#include "connparams.h"
+#include "fixedqueue.h"
+#include "icontransfer.h"
 #include "keyval.h"
+#include "latency.h"
+#include "linkhealth.h"
+#include "memreport.h"
+#include "navfields.h"
+#include "navsync.h"
 #include "preferences.h"
 #include "scheduler.h"
+#include "telemetry.h"
 #include "theme.h"
+#include "throughput.h"
 #include "ui.h"
 
-#include <queue>
+#include <atomic>
+#include <climits>
 
-std::queue<String> navigationQueue{};
+// Older packets are kept, a dropped delta is recovered by NavSync
+#define NAVIGATION_QUEUE_MAX_SIZE  16
+#define NAVIGATION_PACKET_MAX_SIZE 512 // max ATT attribute length
+#define NO_PENDING_SPEED           INT_MIN
+
+struct NavigationPacket {
+    uint8_t data[NAVIGATION_PACKET_MAX_SIZE];
+    size_t length;
+    uint32_t received_us;
+};
+
+FixedQueue<NavigationPacket, NAVIGATION_QUEUE_MAX_SIZE> navigationQueue{};
+// Only the latest speed matters, it bypasses the navigation queue
+std::atomic<int> pendingSpeed{NO_PENDING_SPEED};
 bool connectionChanged = true;
 bool oldIsOverspeed    = false;
 
 void onCharacteristicWrite(const String& uuid, uint8_t* data, size_t length) {
-    String value = (uuid != CHA_NAV_TBT_ICON) ? String((char*)(data)) : String();
+    // Dropped while a replay feeds the same queues, see capture.h
+    const Capture::LiveWrite write(uuid, data, length);
+    if (!write)
+        return;
+
+    applyWrite(uuid, data, length);
+}
+
+// Live writes, and the recorded ones replayed by Capture::update()
+void applyWrite(const String& uuid, uint8_t* data, size_t length) {
+    if (uuid == CHA_THROUGHPUT) {
+        Throughput::onWrite(data, length);
+        return;
+    }
 
     if (uuid == CHA_SETTINGS) {
-        const auto kv = kvParseMultiline(value);
+        const auto kv = kvParse(data, length);
 
-        Pref::lightTheme = kv.getOrDefault("lightTheme", "false") == "true";
-        Pref::brightness = kv.getOrDefault("brightness", "100").toInt();
-        Pref::speedLimit = kv.getOrDefault("speedLimit", "60").toInt();
+        Pref::lightTheme = kv.get("lightTheme") == "true";
+        Pref::brightness = kv.getIntOrDefault("brightness", 100);
+        Pref::speedLimit = kv.getIntOrDefault("speedLimit", 60);
 
         lcd.setBrightness(Pref::brightness);
         Pref::lightTheme ? ThemeControl::light() : ThemeControl::dark();
 
         if (kv.contains("removeAllFiles")) {
-            Data::removeAllFiles();
+            Data::requestRemoveAllFiles();
+        }
+
+        if (kv.contains("memoryReport")) {
+            MemoryReport::request();
+        }
+
+        if (kv.contains("iconBenchmark")) {
+            Data::requestIconBenchmark();
+        }
+
+        // Record and replay of the ingest traffic, see capture.h
+        const auto capture = kv.get("capture");
+        if (capture == "start") Capture::request(Capture::COMMAND_START_CAPTURE);
+        if (capture == "stop")  Capture::request(Capture::COMMAND_STOP_CAPTURE);
+
+        const auto replay = kv.get("replay");
+        if (replay == "stop") {
+            Capture::request(Capture::COMMAND_STOP_REPLAY);
+        } else if (!replay.isEmpty()) {
+            Capture::request(Capture::COMMAND_START_REPLAY, replay.toInt());
         }
     }
 
     if (uuid == CHA_NAV) {
-        navigationQueue.push(value);
+        const auto packet = navigationQueue.prepare();
+        if (packet && length <= NAVIGATION_PACKET_MAX_SIZE) {
+            memcpy(packet->data, data, length);
+            packet->length      = length;
+            packet->received_us = micros();
+            navigationQueue.commit();
+        } else {
+            Telemetry::countDropped();
+        }
+        pongNavigation();
+    }
+
+    if (uuid == CHA_NAV_TBT_ICON && IconTransfer::isTransferPacket(data, length)) {
+        IconTransfer::onPacket(data, length);
         pongNavigation();
+        return;
     }
 
     if (uuid == CHA_NAV_TBT_ICON) {
@@ -65,14 +138,16 @@ void onCharacteristicWrite(const String& uuid, uint8_t* data, size_t length) {
     
         const uint8_t* bitmap = data + semicolonIndex + 1;
     
-        Data::receiveNewIcon(iconHash, bitmap);
+        Data::receiveNewIcon(iconHash, IconCodec::FORMAT_1BPP, bitmap, ICON_BITMAP_BUFFER_SIZE);
     
         pongNavigation();
     }
 
 
     if (uuid == CHA_GPS_SPEED) {
-        navigationQueue.push(String("speed=") + value);
+        if (pendingSpeed.exchange(KvSpan((char*)data, length).toInt()) != NO_PENDING_SPEED) {
+            Telemetry::countCoalesced();
+        }
         pongSpeed();
     }
 }
@@ -86,28 +161,41 @@ uint32_t gLastSpeedDataReceived_ms      = 0;
 
 void pongNavigation() {
     gLastNavigationDataReceived_ms = millis();
+    LinkHealth::onArrival(LinkHealth::STREAM_NAVIGATION, gLastNavigationDataReceived_ms);
 }
 
 void pongSpeed() {
     gLastSpeedDataReceived_ms = millis();
+    LinkHealth::onArrival(LinkHealth::STREAM_SPEED, gLastSpeedDataReceived_ms);
 }
 
 void processQueue() {
+    ALLOCATION_STRICT_SCOPE("navigation");
+
+    const auto speed = pendingSpeed.exchange(NO_PENDING_SPEED);
+    if (speed != NO_PENDING_SPEED) {
+        Data::setSpeed(speed);
+    }
+
     if (navigationQueue.empty())
         return;
 
-    const auto& data = navigationQueue.front();
-    const auto kv    = kvParseMultiline(data);
+    const auto& packet = navigationQueue.front();
+    Latency::onDequeued(packet.received_us);
+
+    const auto kv = kvParse(packet.data, packet.length);
+    Latency::onParsed(kv);
+
+    if (!NavSync::accept(kv)) {
+        Latency::onDiscarded();
+        Telemetry::countDropped();
+        navigationQueue.pop();
+        return;
+    }
 
     // LVGL9-safe: perform model updates; UI::update() will handle the actual LVGL redraw.
-    if (kv.contains("nextRd"))        Data::setNextRoad(kv.getOrDefault("nextRd"));
-    if (kv.contains("nextRdDesc"))    Data::setNextRoadDesc(kv.getOrDefault("nextRdDesc"));
-    if (kv.contains("distToNext"))    Data::setDistanceToNextTurn(kv.getOrDefault("distToNext"));
-    if (kv.contains("totalDist"))     Data::setTotalDistance(kv.getOrDefault("totalDist"));
-    if (kv.contains("eta"))           Data::setEta(kv.getOrDefault("eta"));
-    if (kv.contains("ete"))           Data::setEte(kv.getOrDefault("ete"));
-    if (kv.contains("iconHash"))      Data::setIconHash(kv.getOrDefault("iconHash"));
-    if (kv.contains("speed"))         Data::setSpeed(kv.getOrDefault("speed").toInt());
+    NavFields::apply(kv);
+    Latency::onApplied();
 
     navigationQueue.pop();
 }
@@ -118,6 +206,7 @@ void setup() {
     Serial.begin(115200);
     Serial.println("Initializing BLE...");
     initBle();
+    ConnParams::init();
 
     Serial.println("Initializing UI...");
     UI::init();
@@ -127,7 +216,12 @@ void setup() {
     lcd.setBrightness(Pref::brightness);
     ThemeControl::dark();
 
+    // The other static buffers are registered by their modules
+    MemoryReport::addStatic("navigationQueue", sizeof(navigationQueue));
+    MemoryReport::init();
+
     Serial.println("Init done");
+    Allocations::init();
 }
 
 bool isOverspeed(int speed) {
@@ -135,13 +229,36 @@ bool isOverspeed(int speed) {
 }
 
 void loop() {
+    Telemetry::onLoop();
+
     // Update UI and data. UI::update() calls lv_timer_handler() internally (LVGL9).
-    UI::update();
-    ThemeControl::update();
-    Data::update();
+    {
+        ALLOCATION_SCOPE("ui");
+        UI::update();
+        ThemeControl::update();
+    }
+    {
+        ALLOCATION_SCOPE("data");
+        Data::update();
+    }
 
     processQueue();
 
+    DO_EVERY(100) {
+        ALLOCATION_SCOPE("link");
+        ConnParams::update();
+        LinkHealth::update();
+    }
+
+    {
+        ALLOCATION_SCOPE("diagnostics");
+        Telemetry::update(navigationQueue.size());
+        Latency::update();
+        Capture::update(navigationQueue.size());
+        Allocations::update();
+        MemoryReport::update();
+    }
+
     // Overspeed check (instant change detection)
     const auto newIsOverspeed = isOverspeed(Data::speed());
     if (newIsOverspeed != oldIsOverspeed) {
@@ -160,9 +277,17 @@ void loop() {
     // Connection status handling
     if (connectionChanged) {
         connectionChanged = false;
+        ConnParams::reset();
+        LinkHealth::reset();
+
+        if (deviceConnected) {
+            ConnParams::negotiateLink();
+        }
 
         if (!deviceConnected) {
-            navigationQueue = std::queue<String>();
+            navigationQueue.clear();
+            pendingSpeed    = NO_PENDING_SPEED;
+            NavSync::reset();
             Data::clearNavigationData();
             Data::clearSpeedData();
             Data::setNextRoadDesc("Disconnected!");
@@ -0,0 +1,53 @@
+#ifndef FIXEDQUEUE_H
+#define FIXEDQUEUE_H
+
+#include <atomic>
+
+/**
+ * Bounded FIFO without allocation, for one producer (the BLE task, or a capture replay in its place,
+ * see capture.h) and one consumer (the loop). The producer fills the slot returned by prepare() and
+ * publishes it with commit().
+ */
+template <typename T, size_t CAPACITY>
+class FixedQueue {
+  public:
+	// nullptr if full
+	T* prepare() {
+		const auto tail = _tail.load(std::memory_order_relaxed);
+		if (tail - _head.load(std::memory_order_acquire) >= CAPACITY)
+			return nullptr;
+		return &_items[tail % CAPACITY];
+	}
+
+	void commit() {
+		_tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	bool empty() const {
+		return size() == 0;
+	}
+
+	size_t size() const {
+		return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+	}
+
+	T& front() {
+		return _items[_head.load(std::memory_order_relaxed) % CAPACITY];
+	}
+
+	void pop() {
+		_head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// Consumer side
+	void clear() {
+		_head.store(_tail.load(std::memory_order_acquire), std::memory_order_release);
+	}
+
+  private:
+	T _items[CAPACITY];
+	std::atomic<size_t> _head{0};
+	std::atomic<size_t> _tail{0};
+};
+
+#endif // FIXEDQUEUE_H
@@ -0,0 +1,19 @@
+#ifndef FLASHFS_H
+#define FLASHFS_H
+
+#include "config.h"
+
+#include "FS.h"
+
+// File system on the "spiffs" partition, for icon files (without the raw icon store) and captures
+#if ICON_STORAGE == ICON_STORAGE_LITTLEFS
+#include "LittleFS.h"
+#define FLASH_FS      LittleFS
+#define FLASH_FS_NAME "LittleFS"
+#else
+#include "SPIFFS.h"
+#define FLASH_FS      SPIFFS
+#define FLASH_FS_NAME "SPIFFS"
+#endif
+
+#endif // FLASHFS_H
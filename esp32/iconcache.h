@@ -0,0 +1,179 @@
+#ifndef ICONCACHE_H
+#define ICONCACHE_H
+
+#include "telemetry.h"
+
+// A decoded icon, as LVGL draws it
+struct IconImage {
+	uint16_t width;
+	uint16_t height;
+	uint16_t stride;
+	uint8_t colorFormat; // lv_color_format_t
+	uint32_t size;       // bytes, with the palette of indexed images
+};
+
+/**
+ * Recently displayed icons, decoded and ready for LVGL, least recently used first out. Showing a
+ * cached icon only changes which buffer is displayed. The displayed buffer is never reused for
+ * decoding, so LVGL can keep drawing it until the new icon is set. Icons of upcoming maneuvers are
+ * decoded ahead of time with prefetch().
+ *
+ * Decoded icons differ in size (an indexed icon is a quarter of an RGB565 one), so the buffer is
+ * split in SLOTS slots of SLOT_SIZE and an icon takes a power of two of them, aligned to its own
+ * size like in a buddy allocator. Making room evicts every icon in the chosen slots.
+ */
+template <size_t SLOT_SIZE, size_t SLOTS>
+class IconCache {
+	static_assert((SLOTS & (SLOTS - 1)) == 0, "SLOTS must be a power of two");
+
+  public:
+	// Display the icon of `key` if it is cached
+	bool show(uint64_t key) {
+		const auto index = find(key);
+		if (index < 0) {
+			Telemetry::countIconMiss();
+			return false;
+		}
+
+		touch(index);
+		_displayed = index;
+		Telemetry::countIconHit();
+		return true;
+	}
+
+	bool contains(uint64_t key) const {
+		return find(key) >= 0;
+	}
+
+	// Half the cache at most, the displayed icon is in the other half
+	bool fits(const IconImage& image) const {
+		return image.size <= SLOT_SIZE * SLOTS / 2;
+	}
+
+	// Buffer for the next icon to display, remember() it once it is decoded. `image` must fit().
+	uint8_t* acquire(const IconImage& image) {
+		_displayed = evict(image);
+		return _buffer + _displayed * SLOT_SIZE;
+	}
+
+	// The displayed buffer holds the icon of `key`
+	void remember(uint64_t key) {
+		const auto index = find(key);
+		if (index >= 0)
+			_entries[index].valid = false;
+
+		_entries[_displayed].key   = key;
+		_entries[_displayed].valid = true;
+	}
+
+	// Decode the icon of `key` with `decode(buffer)` without displaying it, show() finds it later
+	template <typename Decode> bool prefetch(uint64_t key, const IconImage& image, Decode&& decode) {
+		if (contains(key))
+			return true;
+
+		const auto index = evict(image);
+		if (!decode(_buffer + index * SLOT_SIZE))
+			return false;
+
+		_entries[index].key   = key;
+		_entries[index].valid = true;
+		return true;
+	}
+
+	const uint8_t* displayed() const {
+		return _buffer + _displayed * SLOT_SIZE;
+	}
+
+	const IconImage& displayedImage() const {
+		return _entries[_displayed].image;
+	}
+
+	// e.g. when icon colours change, the displayed buffer stays as it is
+	void clear() {
+		for (auto& entry : _entries)
+			entry.valid = false;
+	}
+
+  private:
+	// Only the first slot of an icon has an entry, `span` is its slot count
+	struct Entry {
+		uint64_t key;
+		uint32_t lastUsed;
+		IconImage image;
+		uint8_t span;
+		bool valid;
+	};
+
+	static uint8_t spanOf(const IconImage& image) {
+		uint8_t span = 1;
+		while (span * SLOT_SIZE < image.size)
+			span *= 2;
+		return span;
+	}
+
+	int32_t find(uint64_t key) const {
+		for (size_t i = 0; i < SLOTS; i++) {
+			if (_entries[i].span && _entries[i].valid && _entries[i].key == key)
+				return i;
+		}
+		return -1;
+	}
+
+	bool overlaps(size_t index, size_t first, uint8_t span) const {
+		return _entries[index].span && index < first + span && first < index + _entries[index].span;
+	}
+
+	void touch(size_t index) {
+		_entries[index].lastUsed = ++_clock;
+	}
+
+	// Latest use of the icons in [first, first + span), UINT32_MAX if the displayed one is there
+	uint32_t lastUseIn(size_t first, uint8_t span) const {
+		uint32_t lastUsed = 0;
+		for (size_t i = 0; i < SLOTS; i++) {
+			if (!overlaps(i, first, span))
+				continue;
+			if (i == _displayed)
+				return UINT32_MAX;
+			if (_entries[i].valid)
+				lastUsed = std::max(lastUsed, _entries[i].lastUsed);
+		}
+		return lastUsed;
+	}
+
+	// Least recently used slots for `image` but not the displayed icon, emptied
+	size_t evict(const IconImage& image) {
+		const auto span = spanOf(image);
+
+		size_t victim   = 0;
+		uint32_t oldest = UINT32_MAX;
+		for (size_t first = 0; first < SLOTS; first += span) {
+			const auto lastUsed = lastUseIn(first, span);
+			if (lastUsed < oldest) {
+				victim = first;
+				oldest = lastUsed;
+			}
+		}
+
+		for (size_t i = 0; i < SLOTS; i++) {
+			if (!overlaps(i, victim, span))
+				continue;
+			if (_entries[i].valid)
+				Telemetry::countIconEviction();
+			_entries[i].valid = false;
+			_entries[i].span  = 0;
+		}
+
+		_entries[victim].image = image;
+		_entries[victim].span  = span;
+		touch(victim);
+		return victim;
+	}
+
+	Entry _entries[SLOTS] = {};
+	size_t _displayed     = 0;
+	uint32_t _clock       = 0;
+	alignas(4) uint8_t _buffer[SLOTS * SLOT_SIZE];
+};
+
+#endif // ICONCACHE_H
@@ -0,0 +1,120 @@
+#ifndef ICONCODEC_H
+#define ICONCODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Icon payload formats.
+ *
+ * Turn icons are mostly white space with thick strokes, so the bitmap is PackBits encoded
+ * row-major. It is 1 bit per pixel, or 2 bits of coverage per pixel for anti-aliased icons. The
+ * decoder is streaming: every decoded byte goes straight to a sink (e.g. the RGB565 render buffer),
+ * there is no intermediate bitmap copy.
+ *
+ * Colour icons (lane guidance, highway shields) are palette indexed and sized by their header:
+ * [width u8][height u8][16 x RGB565 u16 palette][4-bit indices], two pixels per byte with the
+ * leftmost one in the high bits, rows padded to whole bytes. Only the indices are PackBits encoded.
+ */
+namespace IconCodec {
+	enum Format : uint8_t {
+		FORMAT_1BPP          = 0, // raw 1-bit bitmap, MSB first
+		FORMAT_1BPP_PACKBITS = 1, // PackBits encoded 1-bit bitmap
+		FORMAT_2BPP          = 2, // raw 2-bit coverage bitmap, leftmost pixel in the high bits
+		FORMAT_2BPP_PACKBITS = 3, // PackBits encoded 2-bit coverage bitmap
+		FORMAT_I4            = 4, // indexed header, raw indices
+		FORMAT_I4_PACKBITS   = 5, // indexed header, PackBits encoded indices
+	};
+
+	constexpr size_t PALETTE_SIZE        = 16;
+	constexpr size_t INDEXED_HEADER_SIZE = 2 + 2 * PALETTE_SIZE;
+
+	// Worst case PackBits output: one header byte for every 128 literal bytes
+	constexpr size_t packBitsMaxSize(size_t size) {
+		return size + (size + 127) / 128;
+	}
+
+	bool isKnownFormat(uint8_t format) {
+		return format <= FORMAT_I4_PACKBITS;
+	}
+
+	bool isIndexed(uint8_t format) {
+		return format == FORMAT_I4 || format == FORMAT_I4_PACKBITS;
+	}
+
+	uint8_t bitsPerPixel(uint8_t format) {
+		if (isIndexed(format))
+			return 4;
+		return format == FORMAT_2BPP || format == FORMAT_2BPP_PACKBITS ? 2 : 1;
+	}
+
+	// Decoded 4-bit indices of an indexed icon
+	constexpr size_t indexedSize(uint16_t width, uint16_t height) {
+		return (width + 1) / 2 * height;
+	}
+
+	/**
+	 * Decode PackBits `src` and pass each of the `expected` output bytes to `sink`.
+	 * Returns false on malformed or truncated input, `sink` may have been called already.
+	 */
+	template <typename Sink> bool unpackBits(const uint8_t* src, size_t length, size_t expected, Sink&& sink) {
+		size_t in  = 0;
+		size_t out = 0;
+
+		while (in < length && out < expected) {
+			const int8_t header = (int8_t)src[in++];
+
+			// No-op
+			if (header == -128)
+				continue;
+
+			// Literal run
+			if (header >= 0) {
+				const size_t count = header + 1;
+				if (in + count > length || out + count > expected)
+					return false;
+
+				for (size_t i = 0; i < count; i++)
+					sink(src[in++]);
+				out += count;
+				continue;
+			}
+
+			// Repeated byte
+			const size_t count = 1 - header;
+			if (in >= length || out + count > expected)
+				return false;
+
+			const uint8_t value = src[in++];
+			for (size_t i = 0; i < count; i++)
+				sink(value);
+			out += count;
+		}
+
+		return out == expected;
+	}
+
+	/**
+	 * Decode `data` of the given format into `expected` bitmap bytes, passed to `sink` one by one.
+	 * For indexed formats `data` starts after the header.
+	 */
+	template <typename Sink>
+	bool decode(uint8_t format, const uint8_t* data, size_t length, size_t expected, Sink&& sink) {
+		switch (format) {
+		case FORMAT_1BPP:
+		case FORMAT_2BPP:
+		case FORMAT_I4:
+			if (length != expected)
+				return false;
+			for (size_t i = 0; i < length; i++)
+				sink(data[i]);
+			return true;
+		case FORMAT_1BPP_PACKBITS:
+		case FORMAT_2BPP_PACKBITS:
+		case FORMAT_I4_PACKBITS: return unpackBits(data, length, expected, sink);
+		default: return false;
+		}
+	}
+} // namespace IconCodec
+
+#endif // ICONCODEC_H
@@ -0,0 +1,356 @@
+#ifndef ICONFILES_H
+#define ICONFILES_H
+
+#include "flashfs.h"
+#include "iconindex.h"
+#include "iconmanifest.h"
+#include "memreport.h"
+#include "storagetask.h"
+
+#include <atomic>
+#include <esp_rom_crc.h>
+
+/**
+ * Icons as files on the flash file system (FLASH_FS, SPIFFS or LittleFS): /<hash>.icn holding
+ * [format][payload]. The index of cached icons and their use counts are kept in RAM and saved to
+ * INDEX_FILE, so boot reads one file. The directory is only listed when it is missing or corrupt.
+ *
+ * Least used files are evicted above FILL_TARGET percent of the file system, or when the index is
+ * full, down to INDEX_TARGET of it: each round halves the use counts and removes the files whose
+ * count reached zero, icons no longer seen fade out.
+ *
+ * Changed by the storage task only, under StorageTask::Lock for the index alone (see storagetask.h).
+ */
+namespace IconFiles {
+	namespace detail {
+		constexpr const char* EXTENSION  = ".icn";
+		constexpr const char* INDEX_FILE = "/index.dat";
+		constexpr uint32_t INDEX_SLOTS   = 1024; // 3/4 of it can be used
+		constexpr uint8_t FILL_TARGET    = 75;   // percent
+		constexpr uint8_t INDEX_TARGET   = 87;   // percent of the index capacity left after evicting
+		constexpr uint8_t EVICT_ROUNDS   = 17;   // down from any 16-bit count
+		constexpr uint16_t INDEX_MAGIC   = 0x1D58;
+
+		// INDEX_FILE: [IndexHeader][IndexEntry x count], the CRC covers the entries
+		struct __attribute__((packed)) IndexHeader {
+			uint16_t magic;
+			uint16_t count;
+			uint32_t crc;
+		};
+
+		struct __attribute__((packed)) IndexEntry {
+			uint64_t key;
+			uint16_t uses;
+		};
+
+		IconIndex<INDEX_SLOTS> index;
+		std::atomic<bool> dirty{false};     // icons added or removed
+		std::atomic<bool> usesDirty{false}; // use counts only
+		const MemoryReport::Registration indexRegistration{"iconFilesIndex", sizeof(index)};
+
+		String pathOf(const String& hash) {
+			return String("/") + hash + EXTENSION;
+		}
+
+		uint64_t keyOf(const String& fileName) {
+			return IconManifest::iconKey(fileName.c_str(), fileName.length() - strlen(EXTENSION));
+		}
+
+		bool isFsFull() {
+			return FLASH_FS.usedBytes() * 100 > FLASH_FS.totalBytes() * FILL_TARGET;
+		}
+
+		// A new icon could not be indexed
+		bool isFull() {
+			return isFsFull() || index.size() >= index.capacity();
+		}
+
+		// Evicting stops below both targets, so the next icons do not each list the directory again
+		bool isAboveTarget() {
+			return isFsFull() || index.size() * 100 > index.capacity() * INDEX_TARGET;
+		}
+
+		// Returns false if the index file is missing or corrupt
+		bool loadIndex() {
+			File file = FLASH_FS.open(INDEX_FILE, FILE_READ);
+			if (!file)
+				return false;
+
+			IndexHeader header;
+			if (file.read((uint8_t*)&header, sizeof(header)) != sizeof(header) || header.magic != INDEX_MAGIC ||
+			    file.size() != sizeof(header) + header.count * sizeof(IndexEntry)) {
+				return false;
+			}
+
+			index.clear();
+
+			uint32_t crc = 0;
+			IndexEntry entry;
+			for (uint16_t i = 0; i < header.count; i++) {
+				if (file.read((uint8_t*)&entry, sizeof(entry)) != sizeof(entry))
+					break;
+				crc = esp_rom_crc32_le(crc, (const uint8_t*)&entry, sizeof(entry));
+				index.insert(entry.key, entry.uses);
+			}
+
+			if (crc != header.crc) {
+				Serial.println("Icon index file corrupt");
+				index.clear();
+				return false;
+			}
+			return true;
+		}
+
+		void list() {
+			index.clear();
+
+			File root = FLASH_FS.open("/");
+			File file = root.openNextFile();
+			while (file) {
+				const String name = file.name();
+				const String path = file.path();
+				file              = root.openNextFile();
+
+				if (name.endsWith(EXTENSION)) {
+					index.insert(keyOf(name), 0);
+				} else if (name.endsWith(".bin")) {
+					// Raw icons from older firmware, the phone will send them again
+					FLASH_FS.remove(path);
+				}
+			}
+		}
+	} // namespace detail
+
+	uint32_t count() {
+		return detail::index.size();
+	}
+
+	bool contains(const String& hash) {
+		return detail::index.contains(IconManifest::iconKey(hash));
+	}
+
+	bool isIndexDirty() {
+		return detail::dirty || detail::usesDirty;
+	}
+
+	// Icons added or removed since the index was saved
+	bool hasNewEntries() {
+		return detail::dirty;
+	}
+
+	// Written after every batch of icon writes (IconStorage::commit()), use counts alone every now
+	// and then. Entries of files that are gone are dropped when they fail to load.
+	void saveIndex() {
+		using namespace detail;
+
+		dirty     = false;
+		usesDirty = false;
+
+		IndexHeader header = {INDEX_MAGIC, 0, 0};
+		index.forEach([&header](uint64_t key, uint16_t uses) {
+			const IndexEntry entry = {key, uses};
+			header.crc             = esp_rom_crc32_le(header.crc, (const uint8_t*)&entry, sizeof(entry));
+			header.count++;
+		});
+
+		File file = FLASH_FS.open(INDEX_FILE, FILE_WRITE);
+		if (!file)
+			return;
+
+		file.write((const uint8_t*)&header, sizeof(header));
+		index.forEach([&file](uint64_t key, uint16_t uses) {
+			const IndexEntry entry = {key, uses};
+			file.write((const uint8_t*)&entry, sizeof(entry));
+		});
+	}
+
+	// Returns true if the index file was used, false if the directory was listed
+	bool init() {
+		if (detail::loadIndex())
+			return true;
+
+		detail::list();
+		saveIndex();
+		return false;
+	}
+
+	// `keep` is the icon just written, its file is not evicted
+	void evict(uint64_t keep) {
+		using namespace detail;
+
+		uint32_t evicted = 0;
+		for (uint8_t round = 0; round < EVICT_ROUNDS && isAboveTarget(); round++) {
+			{
+				StorageTask::Lock lock;
+				index.forEachSlot([](int32_t slot) { index.setValue(slot, index.value(slot) / 2); });
+			}
+
+			File root = FLASH_FS.open("/");
+			File file = root.openNextFile();
+			while (file && isAboveTarget()) {
+				const String name = file.name();
+				const String path = file.path();
+				file              = root.openNextFile();
+
+				if (!name.endsWith(EXTENSION))
+					continue;
+
+				const auto key  = keyOf(name);
+				const auto slot = index.find(key);
+				if (key == keep || (slot >= 0 && index.value(slot) > 0))
+					continue;
+
+				if (slot >= 0) {
+					StorageTask::Lock lock;
+					index.remove(slot);
+				}
+				FLASH_FS.remove(path);
+				evicted++;
+			}
+		}
+
+		Serial.printf("Evicted %lu icon files, %s %u/%u B used\n",
+		              (unsigned long)evicted,
+		              FLASH_FS_NAME,
+		              (unsigned)FLASH_FS.usedBytes(),
+		              (unsigned)FLASH_FS.totalBytes());
+
+		// The manifest filter cannot forget a key
+		IconManifest::rebuild([](void (*add)(uint64_t)) { index.forEach([add](uint64_t key, uint16_t) { add(key); }); });
+
+		if (index.needsRebuild()) {
+			StorageTask::Lock lock;
+			index.rebuild();
+		}
+		saveIndex();
+	}
+
+	// [format][payload] into `buffer`, its length, or 0 if the icon is not cached or its file is
+	// unreadable (see remove())
+	size_t read(const String& hash, uint8_t* buffer, size_t capacity) {
+		if (!contains(hash))
+			return 0;
+
+		File file           = FLASH_FS.open(detail::pathOf(hash), FILE_READ);
+		const size_t length = file && file.size() <= capacity ? file.read(buffer, capacity) : 0;
+		return length < 2 ? 0 : length;
+	}
+
+	// The icon was displayed. Saturating, evict() halves it.
+	void countUse(const String& hash) {
+		using namespace detail;
+
+		const auto slot = index.find(IconManifest::iconKey(hash));
+		if (slot < 0)
+			return;
+
+		const auto uses = index.value(slot);
+		{
+			StorageTask::Lock lock;
+			index.setValue(slot, uses == UINT16_MAX ? uses : uses + 1);
+		}
+		usesDirty = true;
+	}
+
+	void remove(const String& hash) {
+		using namespace detail;
+
+		const auto slot = index.find(IconManifest::iconKey(hash));
+		if (slot < 0)
+			return;
+
+		{
+			StorageTask::Lock lock;
+			index.remove(slot);
+		}
+		dirty = true;
+		FLASH_FS.remove(pathOf(hash));
+	}
+
+	bool write(const String& hash, uint8_t format, const uint8_t* data, size_t length) {
+		using namespace detail;
+
+		File file = FLASH_FS.open(pathOf(hash), FILE_WRITE);
+		if (!file)
+			return false;
+
+		const bool written = file.write(&format, 1) == 1 && file.write(data, length) == length;
+		file.close();
+		if (!written) {
+			FLASH_FS.remove(pathOf(hash));
+			return false;
+		}
+
+		const auto key = IconManifest::iconKey(hash);
+		if (isFull())
+			evict(key);
+
+		// Received because it is displayed, the phone only sends missing icons. An icon left out of
+		// the index would be requested again forever.
+		bool inserted;
+		{
+			StorageTask::Lock lock;
+			if (index.needsRebuild())
+				index.rebuild();
+			inserted = index.insert(key, 1);
+		}
+		if (!inserted) {
+			FLASH_FS.remove(pathOf(hash));
+			return false;
+		}
+		dirty = true;
+		return true;
+	}
+
+	void clear() {
+		using namespace detail;
+
+		File root = FLASH_FS.open("/");
+		File file = root.openNextFile();
+		while (file) {
+			const String name = file.name();
+			const String path = file.path();
+			file              = root.openNextFile();
+
+			if (name.endsWith(EXTENSION))
+				FLASH_FS.remove(path);
+		}
+
+		{
+			StorageTask::Lock lock;
+			index.clear();
+		}
+		saveIndex();
+	}
+
+	// Icon files cached before the raw icon store, each given to `store(hash, format, data, length)`
+	// and removed. `buffer` holds one file.
+	template <typename Store> void migrate(uint8_t* buffer, size_t capacity, Store&& store) {
+		using namespace detail;
+
+		File root = FLASH_FS.open("/");
+		File file = root.openNextFile();
+		while (file) {
+			const String name = file.name();
+			if (name.endsWith(EXTENSION)) {
+				const auto length = file.size() <= capacity ? file.read(buffer, capacity) : 0;
+				if (length >= 2)
+					store(name.substring(0, name.length() - strlen(EXTENSION)), buffer[0], buffer + 1, length - 1);
+				FLASH_FS.remove(file.path());
+			} else if (name.endsWith(".bin")) {
+				FLASH_FS.remove(file.path());
+			}
+			file = root.openNextFile();
+		}
+
+		FLASH_FS.remove(INDEX_FILE);
+		index.clear();
+	}
+
+	// `callback(key)` for every icon, see IconManifest::addKey()
+	template <typename Callback> void forEach(Callback&& callback) {
+		detail::index.forEach([&callback](uint64_t key, uint16_t) { callback(key); });
+	}
+} // namespace IconFiles
+
+#endif // ICONFILES_H
@@ -0,0 +1,162 @@
+#ifndef ICONINDEX_H
+#define ICONINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Fixed-size open-addressing table of icon keys (IconManifest::iconKey, 40 bits for the usual
+ * 10 hex digit hashes), each with a 16-bit value. A slot is one packed word, (key << 16) | value,
+ * so a lookup is a couple of linear probes over consecutive words and no string is compared.
+ *
+ * Removed keys leave a tombstone to keep later probe sequences intact. Tombstones are only reused
+ * by inserts, needsRebuild() tells when they make probing long enough for rebuild().
+ */
+template <uint32_t SLOTS> class IconIndex {
+	static_assert((SLOTS & (SLOTS - 1)) == 0, "SLOTS must be a power of two");
+
+  public:
+	static constexpr uint64_t KEY_MASK = 0xFFFFFFFFFFFF;
+
+	IconIndex() {
+		clear();
+	}
+
+	void clear() {
+		memset(_slots, 0xFF, sizeof(_slots));
+		_size = 0;
+		_used = 0;
+	}
+
+	// Slot of `key` whose value passes `accept(value)`, -1 if there is none
+	template <typename Accept> int32_t find(uint64_t key, Accept&& accept) const {
+		key &= KEY_MASK;
+
+		for (uint32_t probe = 0, slot = slotOf(key); probe < SLOTS; probe++, slot = next(slot)) {
+			const auto entry = _slots[slot];
+			if (entry == EMPTY)
+				return -1;
+			if (entry != TOMBSTONE && entry >> 16 == key && accept((uint16_t)entry))
+				return slot;
+		}
+		return -1;
+	}
+
+	int32_t find(uint64_t key) const {
+		return find(key, [](uint16_t) { return true; });
+	}
+
+	bool contains(uint64_t key) const {
+		return find(key) >= 0;
+	}
+
+	// Does not check for duplicates, returns false when the table is full
+	bool insert(uint64_t key, uint16_t value) {
+		key &= KEY_MASK;
+
+		if (_size >= MAX_SIZE)
+			return false;
+
+		for (uint32_t slot = slotOf(key);; slot = next(slot)) {
+			if (_slots[slot] == EMPTY || _slots[slot] == TOMBSTONE) {
+				if (_slots[slot] == EMPTY)
+					_used++;
+				_slots[slot] = key << 16 | value;
+				_size++;
+				return true;
+			}
+		}
+	}
+
+	void remove(int32_t slot) {
+		_slots[slot] = TOMBSTONE;
+		_size--;
+	}
+
+	uint16_t value(int32_t slot) const {
+		return (uint16_t)_slots[slot];
+	}
+
+	void setValue(int32_t slot, uint16_t value) {
+		_slots[slot] = (_slots[slot] & ~0xFFFFULL) | value;
+	}
+
+	uint32_t size() const {
+		return _size;
+	}
+
+	// Entries insert() accepts
+	static constexpr uint32_t capacity() {
+		return MAX_SIZE;
+	}
+
+	bool needsRebuild() const {
+		return _used > SLOTS * 3 / 4;
+	}
+
+	// Drops the tombstones in place. An entry no longer reachable from its first probe slot moves
+	// back to the first free one, as an insert would place it, until none is left behind.
+	void rebuild() {
+		for (auto& entry : _slots) {
+			if (entry == TOMBSTONE)
+				entry = EMPTY;
+		}
+		_used = _size;
+
+		for (bool moved = true; moved;) {
+			moved = false;
+			for (uint32_t slot = 0; slot < SLOTS; slot++) {
+				const auto entry = _slots[slot];
+				if (entry == EMPTY)
+					continue;
+
+				auto target = slotOf(entry >> 16);
+				while (target != slot && _slots[target] != EMPTY)
+					target = next(target);
+				if (target == slot)
+					continue;
+
+				_slots[target] = entry;
+				_slots[slot]   = EMPTY;
+				moved          = true;
+			}
+		}
+	}
+
+	// `callback(key, value)` for every entry, in slot order
+	template <typename Callback> void forEach(Callback&& callback) const {
+		for (uint32_t slot = 0; slot < SLOTS; slot++) {
+			if (_slots[slot] != EMPTY && _slots[slot] != TOMBSTONE)
+				callback(_slots[slot] >> 16, (uint16_t)_slots[slot]);
+		}
+	}
+
+	// `callback(slot)` for every entry, to update values in place
+	template <typename Callback> void forEachSlot(Callback&& callback) {
+		for (uint32_t slot = 0; slot < SLOTS; slot++) {
+			if (_slots[slot] != EMPTY && _slots[slot] != TOMBSTONE)
+				callback((int32_t)slot);
+		}
+	}
+
+  private:
+	static constexpr uint64_t EMPTY     = ~0ULL;
+	static constexpr uint64_t TOMBSTONE = ~0ULL - 1;
+	static constexpr uint32_t MAX_SIZE  = SLOTS * 3 / 4;
+
+	// Icon hashes are random hex, the low bits are as good as any hash of them
+	static uint32_t slotOf(uint64_t key) {
+		return key & (SLOTS - 1);
+	}
+
+	static uint32_t next(uint32_t slot) {
+		return (slot + 1) & (SLOTS - 1);
+	}
+
+	uint64_t _slots[SLOTS];
+	uint32_t _size = 0; // live entries
+	uint32_t _used = 0; // live entries and tombstones
+};
+
+#endif // ICONINDEX_H
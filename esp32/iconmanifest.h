@@ -0,0 +1,116 @@
+#ifndef ICONMANIFEST_H
+#define ICONMANIFEST_H
+
+#include "ble.h"
+#include "memreport.h"
+
+#include <atomic>
+
+/**
+ * Compact manifest of the icons cached on flash, readable on CHA_NAV_TBT_ICON_MANIFEST so the
+ * phone can skip icons the device already has.
+ *
+ * Layout: [version][hash count][icon count u16][bloom filter bits]
+ * Icon hashes are 10 hex characters (40 bits), bit `i` of the filter is set for the 13-bit slices
+ * `(key >> (13 * i)) % FILTER_BITS`. False positives are recovered by the device asking for the
+ * missing icon when it is displayed. Later versions have the same layout and tell the phone which
+ * icon formats are decoded: 2 adds 2-bpp (anti-aliased) icons, 3 palette-indexed colour icons.
+ *
+ * Filled by the storage task and published by the loop, from a copy taken in a critical section.
+ */
+namespace IconManifest {
+	namespace detail {
+		constexpr uint8_t VERSION      = 3;
+		constexpr uint8_t HASH_COUNT   = 3;
+		constexpr size_t HEADER_SIZE   = 4;
+		constexpr size_t MANIFEST_SIZE = 512; // max ATT attribute length
+		constexpr uint32_t FILTER_BITS = (MANIFEST_SIZE - HEADER_SIZE) * 8;
+
+		uint8_t manifest[MANIFEST_SIZE] = {VERSION, HASH_COUNT};
+		uint8_t published[MANIFEST_SIZE];
+		uint16_t count = 0;
+		std::atomic<bool> dirty{true};
+		portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+		const MemoryReport::Registration manifestRegistration{"iconManifest", sizeof(manifest) + sizeof(published)};
+
+		void insert(uint64_t key) {
+			for (uint8_t i = 0; i < HASH_COUNT; i++) {
+				const uint32_t bit = ((key >> (13 * i)) & 0x1FFF) % FILTER_BITS;
+				manifest[HEADER_SIZE + bit / 8] |= 1 << (bit % 8);
+			}
+			count++;
+		}
+	} // namespace detail
+
+	// Hex digits of the hash, anything else is skipped
+	uint64_t iconKey(const char* iconHash, size_t length) {
+		uint64_t key = 0;
+		for (size_t i = 0; i < length; i++) {
+			const char c = iconHash[i];
+			if (c >= '0' && c <= '9')
+				key = (key << 4) | (c - '0');
+			else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+				key = (key << 4) | ((c | 0x20) - 'a' + 10);
+		}
+		return key;
+	}
+
+	uint64_t iconKey(const String& iconHash) {
+		return iconKey(iconHash.c_str(), iconHash.length());
+	}
+
+	void clear() {
+		using namespace detail;
+
+		portENTER_CRITICAL(&lock);
+		memset(manifest + HEADER_SIZE, 0, MANIFEST_SIZE - HEADER_SIZE);
+		count = 0;
+		dirty = true;
+		portEXIT_CRITICAL(&lock);
+	}
+
+	void addKey(uint64_t key) {
+		using namespace detail;
+
+		portENTER_CRITICAL(&lock);
+		insert(key);
+		dirty = true;
+		portEXIT_CRITICAL(&lock);
+	}
+
+	// The keys given by `forEach(add)` replace the others, never published half done
+	template <typename ForEach> void rebuild(ForEach&& forEach) {
+		using namespace detail;
+
+		portENTER_CRITICAL(&lock);
+		memset(manifest + HEADER_SIZE, 0, MANIFEST_SIZE - HEADER_SIZE);
+		count = 0;
+		forEach(insert);
+		dirty = true;
+		portEXIT_CRITICAL(&lock);
+	}
+
+	void add(const String& iconHash) {
+		addKey(iconKey(iconHash));
+	}
+
+	// Publish the manifest once per loop at most, adding many icons at boot stays cheap
+	void update() {
+		using namespace detail;
+
+		if (!dirty)
+			return;
+
+		portENTER_CRITICAL(&lock);
+		dirty       = false;
+		manifest[2] = count & 0xFF;
+		manifest[3] = count >> 8;
+		memcpy(published, manifest, MANIFEST_SIZE);
+		portEXIT_CRITICAL(&lock);
+
+		setCharacteristicValue(CHA_NAV_TBT_ICON_MANIFEST, published, MANIFEST_SIZE);
+	}
+} // namespace IconManifest
+
+#endif // ICONMANIFEST_H
@@ -0,0 +1,62 @@
+#ifndef ICONPIXELS_H
+#define ICONPIXELS_H
+
+#include "memreport.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Expansion of decoded icon bytes to RGB565 through per-byte tables: a byte is 8 pixels (1-bpp) or
+ * 4 pixels (2-bpp), copied from its table row in one step instead of testing bit by bit. The rows
+ * hold the icon colours, setColors() rebuilds them.
+ *
+ * 2-bpp pixels are coverage levels from 0 (background) to 3 (foreground), the edges of
+ * anti-aliased strokes get the two colours in between.
+ */
+namespace IconPixels {
+	namespace detail {
+		uint16_t table1[256][8];
+		uint16_t table2[256][4];
+		const MemoryReport::Registration tablesRegistration{"iconPixels", sizeof(table1) + sizeof(table2)};
+
+		// `level` thirds of the way from `from` to `to`, per RGB565 channel
+		uint16_t blend(uint16_t from, uint16_t to, uint8_t level) {
+			const auto channel = [from, to, level](uint8_t shift, uint16_t mask) {
+				const uint16_t a = (from >> shift) & mask;
+				const uint16_t b = (to >> shift) & mask;
+				return (uint16_t)(((a * (3 - level) + b * level + 1) / 3) << shift);
+			};
+			return channel(11, 0x1F) | channel(5, 0x3F) | channel(0, 0x1F);
+		}
+	} // namespace detail
+
+	void setColors(uint16_t color, uint16_t bgColor) {
+		using namespace detail;
+
+		uint16_t levels[4];
+		for (uint8_t level = 0; level < 4; level++)
+			levels[level] = blend(bgColor, color, level);
+
+		for (uint16_t bits = 0; bits < 256; bits++) {
+			for (uint8_t i = 0; i < 8; i++)
+				table1[bits][i] = (bits & (0x80 >> i)) ? color : bgColor;
+			for (uint8_t i = 0; i < 4; i++)
+				table2[bits][i] = levels[(bits >> (6 - 2 * i)) & 0x03];
+		}
+	}
+
+	// 8 pixels of a 1-bpp byte, MSB first, returns the next pixel
+	inline uint16_t* expand1(uint8_t bits, uint16_t* pixel) {
+		memcpy(pixel, detail::table1[bits], sizeof(detail::table1[0]));
+		return pixel + 8;
+	}
+
+	// 4 pixels of a 2-bpp byte, high bits first, returns the next pixel
+	inline uint16_t* expand2(uint8_t bits, uint16_t* pixel) {
+		memcpy(pixel, detail::table2[bits], sizeof(detail::table2[0]));
+		return pixel + 4;
+	}
+} // namespace IconPixels
+
+#endif // ICONPIXELS_H
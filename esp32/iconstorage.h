@@ -0,0 +1,175 @@
+#ifndef ICONSTORAGE_H
+#define ICONSTORAGE_H
+
+#include "config.h"
+#include "iconfiles.h"
+#include "iconmanifest.h"
+#if ICON_STORAGE == ICON_STORAGE_RAW
+#include "iconstore.h"
+#endif
+
+/**
+ * Cached icons, on the backend chosen at build time with ICON_STORAGE (config.h):
+ * - ICON_STORAGE_RAW: IconStore, a log in a raw partition read in place from mapped flash. Without
+ *   the partition icons are kept as SPIFFS files, files from before it are moved to the store.
+ * - ICON_STORAGE_SPIFFS, ICON_STORAGE_LITTLEFS: IconFiles on that file system.
+ *
+ * Icons are [format][payload] as received. Only the storage task writes, the backends lock the
+ * index themselves. Other tasks read under StorageTask::TryLock.
+ */
+namespace IconStorage {
+	struct Icon {
+		const uint8_t* data; // valid until the next write
+		size_t length;
+		uint8_t format;
+	};
+
+	namespace detail {
+		constexpr uint32_t FLUSH_PERIOD_ms = 600000;
+
+		uint32_t lastFlush_ms = 0;
+
+		bool isRaw() {
+#if ICON_STORAGE == ICON_STORAGE_RAW
+			return IconStore::isAvailable();
+#else
+			return false;
+#endif
+		}
+	} // namespace detail
+
+	const char* name() {
+		return detail::isRaw() ? "store" : FLASH_FS_NAME;
+	}
+
+	uint32_t count() {
+#if ICON_STORAGE == ICON_STORAGE_RAW
+		if (IconStore::isAvailable())
+			return IconStore::count();
+#endif
+		return IconFiles::count();
+	}
+
+	// `callback(key)` for every icon, see IconManifest::addKey()
+	template <typename Callback> void forEach(Callback&& callback) {
+#if ICON_STORAGE == ICON_STORAGE_RAW
+		if (IconStore::isAvailable())
+			return IconStore::forEach(callback);
+#endif
+		IconFiles::forEach(callback);
+	}
+
+	// Once the file system is mounted. `buffer` holds one icon file, for the move to the store.
+	void init(uint8_t* buffer, size_t capacity) {
+		const auto start_us = micros();
+		const char* source  = "store";
+
+#if ICON_STORAGE == ICON_STORAGE_RAW
+		if (IconStore::init()) {
+			IconFiles::migrate(buffer, capacity, [](const String& hash, uint8_t format, const uint8_t* data, size_t length) {
+				IconStore::append(hash, format, data, length);
+			});
+		} else {
+			source = IconFiles::init() ? "index file" : "directory";
+		}
+#else
+		source = IconFiles::init() ? "index file" : "directory";
+#endif
+
+		IconManifest::clear();
+		forEach(IconManifest::addKey);
+
+		Serial.printf("Icon storage: %u icons in %luus (%s, %s)\n",
+		              (unsigned)count(),
+		              micros() - start_us,
+		              name(),
+		              source);
+	}
+
+	bool contains(const String& hash) {
+#if ICON_STORAGE == ICON_STORAGE_RAW
+		if (IconStore::isAvailable())
+			return IconStore::contains(hash);
+#endif
+		return IconFiles::contains(hash);
+	}
+
+	// `buffer` holds the icon when the backend cannot read it in place
+	bool read(const String& hash, Icon& icon, uint8_t* buffer, size_t capacity) {
+#if ICON_STORAGE == ICON_STORAGE_RAW
+		if (IconStore::isAvailable()) {
+			IconStore::Icon stored;
+			if (!IconStore::find(hash, stored))
+				return false;
+
+			icon = {stored.data, stored.length, stored.format};
+			return true;
+		}
+#endif
+		const auto length = IconFiles::read(hash, buffer, capacity);
+		if (length < 2)
+			return false;
+
+		icon = {buffer + 1, length - 1, buffer[0]};
+		return true;
+	}
+
+	// Counted when the icon is displayed, not when it is read: a prefetch is no use
+	void countUse(const String& hash) {
+#if ICON_STORAGE == ICON_STORAGE_RAW
+		if (IconStore::isAvailable())
+			return IconStore::countUse(hash);
+#endif
+		IconFiles::countUse(hash);
+	}
+
+	// Cached but unreadable (lost file, corrupted record), the phone sends it again when displayed
+	void drop(const String& hash) {
+#if ICON_STORAGE == ICON_STORAGE_RAW
+		if (IconStore::isAvailable())
+			return IconStore::remove(hash);
+#endif
+		IconFiles::remove(hash);
+	}
+
+	bool write(const String& hash, uint8_t format, const uint8_t* data, size_t length) {
+#if ICON_STORAGE == ICON_STORAGE_RAW
+		if (IconStore::isAvailable())
+			return IconStore::append(hash, format, data, length);
+#endif
+		return IconFiles::write(hash, format, data, length);
+	}
+
+	void clear() {
+#if ICON_STORAGE == ICON_STORAGE_RAW
+		IconStore::clear();
+#endif
+		IconFiles::clear();
+		IconManifest::clear();
+	}
+
+	// Use counts not saved yet, at most every FLUSH_PERIOD_ms
+	bool isFlushDue() {
+		using namespace detail;
+
+		if (!IconFiles::isIndexDirty() || millis() - lastFlush_ms <= FLUSH_PERIOD_ms)
+			return false;
+
+		lastFlush_ms = millis();
+		return true;
+	}
+
+	void flush() {
+		if (!detail::isRaw())
+			IconFiles::saveIndex();
+	}
+
+	// After each batch of writes: the power is cut at ignition-off, an icon written but not in the
+	// saved index would be an orphan file until eviction. The icon store needs no index file.
+	void commit() {
+		if (!detail::isRaw() && IconFiles::hasNewEntries())
+			IconFiles::saveIndex();
+	}
+} // namespace IconStorage
+
+#endif // ICONSTORAGE_H
@@ -0,0 +1,457 @@
+#ifndef ICONSTORE_H
+#define ICONSTORE_H
+
+#include "config.h"
+#include "iconindex.h"
+#include "iconmanifest.h"
+#include "memreport.h"
+#include "storagetask.h"
+
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+
+/**
+ * Icons in a raw flash partition (ICON_STORE_PARTITION in config.h, see partitions.csv), kept as an
+ * append-only log of 512-byte blocks. The partition is memory mapped: a lookup is a probe in the RAM
+ * index (IconIndex, key -> first block) and a read is a pointer into flash, there is no file system
+ * and no copy. Without the partition, isAvailable() is false and IconStorage keeps icons as files.
+ *
+ * Record: [header 32 B][payload], padded to whole blocks, never across a 4 KB sector. The payload is
+ * written before the header, so a record cut by a reset has no valid header. A removed record only
+ * gets its LIVE flag cleared, flash bits go from 1 to 0 without an erase.
+ *
+ * Sectors are used as a ring. Before the head moves into a new sector one more erased sector must be
+ * left for compaction, otherwise the oldest sector is reclaimed: its live records are appended again
+ * and it is erased. When the store is full (LIVE_LIMIT records, or 3/4 of the blocks live),
+ * compaction also evicts: each record counts its displays in the `uses` byte, one more bit cleared
+ * per countUse() (so without an erase, up to 8). Unused records are dropped, the others are copied
+ * with their count halved, a second chance that fades for icons no longer seen. The phone sends an
+ * evicted icon again when it is displayed.
+ *
+ * Written by the storage task only. StorageTask::Lock is held while the index changes and while a
+ * sector is erased, so a reader holding it can use a record in place (see storagetask.h).
+ */
+namespace IconStore {
+	struct Icon {
+		const uint8_t* data; // in mapped flash, valid while the storage lock is held
+		size_t length;
+		uint8_t format;
+	};
+
+	namespace detail {
+		constexpr size_t BLOCK_SIZE          = 512;
+		constexpr size_t SECTOR_SIZE         = 4096;
+		constexpr uint32_t BLOCKS_PER_SECTOR = SECTOR_SIZE / BLOCK_SIZE;
+		constexpr uint32_t MIN_SECTORS       = 4;
+		constexpr uint16_t MAGIC             = 0x1C05;
+		constexpr uint8_t FLAG_LIVE          = 0x01;
+		constexpr size_t HASH_CAPACITY       = 16;
+		constexpr uint32_t INDEX_SLOTS       = 2048;
+		constexpr uint32_t LIVE_LIMIT        = INDEX_SLOTS / 2; // keeps probe sequences short
+
+		struct __attribute__((packed)) Header {
+			uint16_t magic;
+			uint8_t flags;
+			uint8_t format;
+			uint16_t length;
+			uint8_t hashLength;
+			uint8_t uses; // 0xFF << count
+			uint32_t sequence;
+			uint32_t crc; // of the payload
+			char hash[HASH_CAPACITY];
+		};
+		static_assert(sizeof(Header) == 32, "Header must stay 32 bytes");
+
+		constexpr size_t MAX_PAYLOAD = SECTOR_SIZE - sizeof(Header);
+
+		const esp_partition_t* partition = nullptr;
+		esp_partition_mmap_handle_t mapping;
+		const uint8_t* flash = nullptr;
+
+		uint32_t sectorCount = 0;
+		uint32_t headSector  = 0; // the one being appended to
+		uint32_t headFill    = 0; // blocks used in it
+		uint32_t tail        = 0; // oldest sector in use
+		uint32_t sequence    = 0;
+		IconIndex<INDEX_SLOTS> index;
+		const MemoryReport::Registration indexRegistration{"iconStoreIndex", sizeof(index)};
+
+		const Header* headerAt(uint32_t block) {
+			return (const Header*)(flash + block * BLOCK_SIZE);
+		}
+
+		uint32_t blocksOf(size_t length) {
+			return (sizeof(Header) + length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		}
+
+		uint32_t sectorOf(uint32_t block) {
+			return block / BLOCKS_PER_SECTOR;
+		}
+
+		uint32_t freeSectors() {
+			return sectorCount - (headSector + sectorCount - tail) % sectorCount - 1;
+		}
+
+		bool isValid(const Header* header, uint32_t block) {
+			return header->magic == MAGIC && header->hashLength > 0 && header->hashLength <= HASH_CAPACITY &&
+			       header->length <= MAX_PAYLOAD && block % BLOCKS_PER_SECTOR + blocksOf(header->length) <= BLOCKS_PER_SECTOR;
+		}
+
+		uint64_t keyOf(const Header* header) {
+			return IconManifest::iconKey(header->hash, header->hashLength);
+		}
+
+		bool matches(const Header* header, const char* hash, size_t length) {
+			return header->hashLength == length && memcmp(header->hash, hash, length) == 0;
+		}
+
+		bool isErased(uint32_t block, uint32_t blocks) {
+			const uint32_t* word = (const uint32_t*)(flash + block * BLOCK_SIZE);
+			for (size_t i = 0; i < blocks * BLOCK_SIZE / 4; i++) {
+				if (word[i] != 0xFFFFFFFF)
+					return false;
+			}
+			return true;
+		}
+
+		// Through a RAM buffer, the source may be mapped flash which is not readable while writing
+		void program(size_t offset, const void* data, size_t length) {
+			uint8_t chunk[128];
+			for (size_t done = 0; done < length; done += sizeof(chunk)) {
+				const auto size = std::min(sizeof(chunk), length - done);
+				memcpy(chunk, (const uint8_t*)data + done, size);
+				esp_partition_write(partition, offset + done, chunk, size);
+			}
+		}
+
+		// Hashes longer than a key are told apart by the one in the header
+		int32_t findSlot(const char* hash, size_t length) {
+			return index.find(IconManifest::iconKey(hash, length),
+			                  [hash, length](uint16_t block) { return matches(headerAt(block), hash, length); });
+		}
+
+		int32_t findSlot(const String& hash) {
+			return findSlot(hash.c_str(), hash.length());
+		}
+
+		uint32_t liveBlocks() {
+			uint32_t blocks = 0;
+			index.forEach([&blocks](uint64_t, uint16_t block) { blocks += blocksOf(headerAt(block)->length); });
+			return blocks;
+		}
+
+		// Mostly live records, compaction alone would free little
+		bool isFull() {
+			return index.size() >= LIVE_LIMIT || liveBlocks() * 4 > sectorCount * BLOCKS_PER_SECTOR * 3;
+		}
+
+		uint8_t usesOf(uint8_t bits) {
+			return 8 - __builtin_popcount(bits);
+		}
+
+		// Records do not cross sectors
+		bool fitsHeadSector(uint32_t blocks) {
+			return headFill + blocks <= BLOCKS_PER_SECTOR;
+		}
+
+		// Returns the first block of the record
+		uint32_t write(const Header& header, const uint8_t* payload) {
+			const auto blocks = blocksOf(header.length);
+
+			if (!fitsHeadSector(blocks)) {
+				headSector = (headSector + 1) % sectorCount;
+				headFill   = 0;
+
+				// A record cut by a reset may have left data without a header
+				if (!isErased(headSector * BLOCKS_PER_SECTOR, BLOCKS_PER_SECTOR))
+					esp_partition_erase_range(partition, headSector * SECTOR_SIZE, SECTOR_SIZE);
+			}
+
+			const auto block = headSector * BLOCKS_PER_SECTOR + headFill;
+			program(block * BLOCK_SIZE + sizeof(Header), payload, header.length);
+			program(block * BLOCK_SIZE, &header, sizeof(Header));
+			headFill += blocks;
+			return block;
+		}
+
+		// Compaction of the oldest sector, evicting unused records if `evict`
+		void reclaim(bool evict) {
+			if (tail == headSector)
+				return;
+
+			uint32_t moved   = 0;
+			uint32_t dropped = 0;
+
+			const auto first = tail * BLOCKS_PER_SECTOR;
+			for (uint32_t block = first; block < first + BLOCKS_PER_SECTOR;) {
+				const auto* header = headerAt(block);
+				if (!isValid(header, block))
+					break;
+
+				// Only the indexed copy is live, not one left by an earlier compaction
+				const auto slot = (header->flags & FLAG_LIVE) ? findSlot(header->hash, header->hashLength) : -1;
+				if (slot >= 0 && index.value(slot) == block) {
+					// No erased sector left to copy to: evict anyway
+					const bool noRoom = !fitsHeadSector(blocksOf(header->length)) && freeSectors() == 0;
+					if ((evict && usesOf(header->uses) == 0) || noRoom) {
+						StorageTask::Lock lock;
+						index.remove(slot);
+						dropped++;
+					} else {
+						auto copy         = *header;
+						copy.sequence     = ++sequence;
+						copy.uses         = evict ? 0xFF << (usesOf(header->uses) / 2) : header->uses;
+						const auto copied = write(copy, (const uint8_t*)(header + 1));
+
+						StorageTask::Lock lock;
+						index.setValue(slot, copied);
+						moved++;
+					}
+				}
+
+				block += blocksOf(header->length);
+			}
+
+			{
+				StorageTask::Lock lock;
+				esp_partition_erase_range(partition, tail * SECTOR_SIZE, SECTOR_SIZE);
+			}
+			tail = (tail + 1) % sectorCount;
+			Serial.printf("Icon store: sector compacted, %lu moved, %lu dropped\n", moved, dropped);
+		}
+
+		// Rebuild the index and find the head from the records on flash
+		void scan() {
+			index.clear();
+			sequence = 0;
+
+			uint32_t oldest   = UINT32_MAX;
+			uint32_t newest   = 0; // last block + 1 of the newest record
+			bool empty        = true;
+
+			for (uint32_t sector = 0; sector < sectorCount; sector++) {
+				const auto first = sector * BLOCKS_PER_SECTOR;
+				for (uint32_t block = first; block < first + BLOCKS_PER_SECTOR;) {
+					const auto* header = headerAt(block);
+					if (!isValid(header, block))
+						break;
+
+					if (header->sequence >= sequence || empty) {
+						sequence = header->sequence;
+						newest   = block + blocksOf(header->length);
+					}
+					if (header->sequence < oldest) {
+						oldest = header->sequence;
+						tail   = sector;
+					}
+					empty = false;
+
+					if (header->flags & FLAG_LIVE) {
+						const auto slot = findSlot(header->hash, header->hashLength);
+
+						// An interrupted compaction leaves two copies, keep the newer one
+						if (slot < 0) {
+							index.insert(keyOf(header), block);
+						} else if (headerAt(index.value(slot))->sequence < header->sequence) {
+							index.setValue(slot, block);
+						}
+					}
+
+					block += blocksOf(header->length);
+				}
+			}
+
+			// New partition, or data from another use of it (e.g. an older SPIFFS): flash bits can only
+			// be cleared by programming, the first sector must be erased before the first record
+			if (empty) {
+				headSector = 0;
+				headFill   = 0;
+				tail       = 0;
+				if (!isErased(0, BLOCKS_PER_SECTOR))
+					esp_partition_erase_range(partition, 0, SECTOR_SIZE);
+				return;
+			}
+
+			headSector = sectorOf(newest - 1);
+			headFill   = newest - headSector * BLOCKS_PER_SECTOR;
+
+			// Written after the newest record but not valid: start over in the next sector
+			if (!isErased(newest, BLOCKS_PER_SECTOR - headFill))
+				headFill = BLOCKS_PER_SECTOR;
+		}
+	} // namespace detail
+
+	bool isAvailable() {
+		return detail::flash != nullptr;
+	}
+
+	uint32_t count() {
+		return detail::index.size();
+	}
+
+	bool init() {
+#ifdef ICON_STORE_PARTITION
+		using namespace detail;
+
+		partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, ICON_STORE_PARTITION);
+		if (!partition) {
+			Serial.println("No icon store partition, icons are kept on SPIFFS");
+			return false;
+		}
+
+		sectorCount = std::min<uint32_t>(partition->size / SECTOR_SIZE, 0x10000 / BLOCKS_PER_SECTOR); // 16-bit block numbers
+		if (sectorCount < MIN_SECTORS ||
+		    esp_partition_mmap(partition, 0, sectorCount * SECTOR_SIZE, ESP_PARTITION_MMAP_DATA, (const void**)&flash, &mapping) != ESP_OK) {
+			Serial.println("Icon store partition unusable, icons are kept on SPIFFS");
+			flash = nullptr;
+			return false;
+		}
+
+		const auto start_us = micros();
+		scan();
+		Serial.printf("Icon store: %lu icons, %lu/%lu sectors free, scanned in %luus\n",
+		              index.size(),
+		              freeSectors(),
+		              sectorCount,
+		              micros() - start_us);
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	bool contains(const String& hash) {
+		return isAvailable() && detail::findSlot(hash) >= 0;
+	}
+
+	// The payload is checked against its CRC, a corrupted record is not found (see remove()). Other
+	// tasks hold StorageTask::TryLock while they use the icon.
+	bool find(const String& hash, Icon& icon) {
+		using namespace detail;
+
+		if (!isAvailable())
+			return false;
+
+		const auto slot = findSlot(hash);
+		if (slot < 0)
+			return false;
+
+		const auto block   = index.value(slot);
+		const auto* header = headerAt(block);
+		const auto* data   = (const uint8_t*)(header + 1);
+
+		if (esp_rom_crc32_le(0, data, header->length) != header->crc) {
+			Serial.println("Icon store: corrupted record");
+			return false;
+		}
+
+		icon = {data, header->length, header->format};
+		return true;
+	}
+
+	// The icon was displayed, one more bit of its `uses` is cleared
+	void countUse(const String& hash) {
+		using namespace detail;
+
+		if (!isAvailable())
+			return;
+
+		const auto slot = findSlot(hash);
+		if (slot < 0)
+			return;
+
+		const auto block   = index.value(slot);
+		const auto* header = headerAt(block);
+		if (header->uses != 0) {
+			const uint8_t uses = header->uses << 1;
+			program(block * BLOCK_SIZE + offsetof(Header, uses), &uses, 1);
+		}
+	}
+
+	bool append(const String& hash, uint8_t format, const uint8_t* data, size_t length) {
+		using namespace detail;
+
+		if (!isAvailable() || hash.isEmpty() || hash.length() > HASH_CAPACITY || length > MAX_PAYLOAD)
+			return false;
+
+		if (contains(hash))
+			return true;
+
+		// Keep an erased sector for compaction and the record count bounded. Unused icons are evicted
+		// when the store is full, or after a whole round of compaction did not make room.
+		const auto blocks  = blocksOf(length);
+		const auto hasRoom = [blocks]() {
+			return (fitsHeadSector(blocks) || freeSectors() >= 2) && index.size() < LIVE_LIMIT;
+		};
+
+		for (uint32_t round = 0; !hasRoom() && round < 6 * sectorCount; round++)
+			reclaim(round >= sectorCount || isFull());
+
+		if (!hasRoom())
+			return false;
+
+		// Tombstones are only cleared by a rebuild
+		if (index.needsRebuild()) {
+			StorageTask::Lock lock;
+			index.rebuild();
+		}
+
+		Header header     = {};
+		header.magic      = MAGIC;
+		header.flags      = 0xFF;
+		header.format     = format;
+		header.length     = length;
+		header.hashLength = hash.length();
+		header.uses       = 0xFE; // received because it is displayed
+		header.sequence   = ++sequence;
+		header.crc        = esp_rom_crc32_le(0, data, length);
+		memcpy(header.hash, hash.c_str(), hash.length());
+
+		const auto block = write(header, data);
+
+		StorageTask::Lock lock;
+		index.insert(IconManifest::iconKey(hash), block);
+		return true;
+	}
+
+	void remove(const String& hash) {
+		using namespace detail;
+
+		if (!isAvailable())
+			return;
+
+		const auto slot = findSlot(hash);
+		if (slot < 0)
+			return;
+
+		const auto block    = index.value(slot);
+		const uint8_t flags = headerAt(block)->flags & ~FLAG_LIVE;
+		program(block * BLOCK_SIZE + offsetof(Header, flags), &flags, 1);
+
+		StorageTask::Lock lock;
+		index.remove(slot);
+	}
+
+	void clear() {
+		using namespace detail;
+
+		if (!isAvailable())
+			return;
+
+		StorageTask::Lock lock;
+		esp_partition_erase_range(partition, 0, sectorCount * SECTOR_SIZE);
+		scan();
+	}
+
+	// `callback(key)` for every icon, see IconManifest::addKey()
+	template <typename Callback> void forEach(Callback&& callback) {
+		using namespace detail;
+
+		if (!isAvailable())
+			return;
+
+		index.forEach([&callback](uint64_t key, uint16_t) { callback(key); });
+	}
+} // namespace IconStore
+
+#endif // ICONSTORE_H
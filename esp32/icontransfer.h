@@ -0,0 +1,174 @@
+#ifndef ICONTRANSFER_H
+#define ICONTRANSFER_H
+
+#include "ble.h"
+#include "memreport.h"
+#include "ui.h"
+
+/**
+ * Chunked icon transfer over CHA_NAV_TBT_ICON, independent of the negotiated MTU.
+ *
+ * Header: [0x01][hash length][hash][total size u16][crc32 u32][format, optional]
+ * Chunk:  [0x02][offset u16][data...]
+ * (all integers little endian, format is an IconCodec::Format and defaults to a raw bitmap)
+ *
+ * Every header and every chunk that leaves a gap is answered on CHA_NAV_TBT_ICON_ACK with
+ * `icon=<hash>\noffset=<n>`, `n` being the number of bytes received so far. Re-sending the header
+ * of an unfinished icon (e.g. after a reconnect) resumes from that offset. A finished icon is
+ * answered with `done=1` once it is taken, a checksum mismatch with `offset=0` and `error=crc`, an
+ * icon that cannot be taken yet with `offset=0` and `error=busy`: the phone sends it again. Hashes are
+ * ICON_HASH_CAPACITY characters at most. An icon that is displayed but not cached is requested with
+ * `icon=<hash>\nmissing=1` (see IconManifest).
+ *
+ * Legacy `hash;<bitmap>` packets are still accepted by the caller.
+ */
+namespace IconTransfer {
+	constexpr uint8_t PACKET_HEADER = 0x01;
+	constexpr uint8_t PACKET_CHUNK  = 0x02;
+
+	namespace detail {
+		constexpr size_t HEADER_SIZE  = 1 + 1 + 2 + 4; // without the hash
+		constexpr size_t CHUNK_HEADER = 1 + 2;
+
+		String hash       = String();
+		uint16_t total    = 0;
+		uint16_t received = 0;
+		uint32_t crc      = 0;
+		uint8_t format    = IconCodec::FORMAT_1BPP;
+		uint8_t buffer[ICON_DATA_MAX_SIZE];
+		const MemoryReport::Registration bufferRegistration{"iconTransfer", sizeof(buffer)};
+
+		uint16_t readU16(const uint8_t* data) {
+			return data[0] | (data[1] << 8);
+		}
+
+		uint32_t readU32(const uint8_t* data) {
+			return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+		}
+
+		void ack(const char* extra = nullptr) {
+			auto message = String("icon=") + hash + "\noffset=" + String(received);
+			if (extra) {
+				message += "\n";
+				message += extra;
+			}
+
+			notifyCharacteristic(CHA_NAV_TBT_ICON_ACK, (uint8_t*)message.c_str(), message.length());
+		}
+	} // namespace detail
+
+	// Same as zlib / java.util.zip.CRC32
+	uint32_t crc32(const uint8_t* data, size_t length) {
+		uint32_t crc = 0xFFFFFFFF;
+		for (size_t i = 0; i < length; i++) {
+			crc ^= data[i];
+			for (uint8_t bit = 0; bit < 8; bit++)
+				crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+		}
+		return ~crc;
+	}
+
+	// An icon is in flight, more chunks are expected
+	bool isReceiving() {
+		return !detail::hash.isEmpty() && detail::received < detail::total;
+	}
+
+	bool isTransferPacket(const uint8_t* data, size_t length) {
+		return length > 0 && (data[0] == PACKET_HEADER || data[0] == PACKET_CHUNK);
+	}
+
+	void onHeader(const uint8_t* data, size_t length) {
+		using namespace detail;
+
+		const size_t hashLength = length > 1 ? data[1] : 0;
+		if (hashLength == 0 || hashLength > ICON_HASH_CAPACITY ||
+		    (length != HEADER_SIZE + hashLength && length != HEADER_SIZE + hashLength + 1)) {
+			Serial.println("Invalid icon header");
+			return;
+		}
+
+		String newHash;
+		newHash.reserve(hashLength);
+		for (size_t i = 0; i < hashLength; i++)
+			newHash += (char)data[2 + i];
+
+		const uint16_t newTotal = readU16(data + 2 + hashLength);
+		const uint32_t newCrc   = readU32(data + 4 + hashLength);
+		const uint8_t newFormat = length > HEADER_SIZE + hashLength ? data[8 + hashLength] : IconCodec::FORMAT_1BPP;
+
+		if (newTotal == 0 || newTotal > sizeof(buffer) || !IconCodec::isKnownFormat(newFormat)) {
+			Serial.print("Invalid icon size or format: ");
+			Serial.println(newTotal);
+			return;
+		}
+
+		// Anything else than the unfinished icon restarts the transfer
+		if (newHash != hash || newTotal != total || newCrc != crc || newFormat != format) {
+			hash     = newHash;
+			total    = newTotal;
+			crc      = newCrc;
+			format   = newFormat;
+			received = 0;
+		} else {
+			Serial.print("Resuming icon at ");
+			Serial.println(received);
+		}
+
+		ack();
+	}
+
+	void onChunk(const uint8_t* data, size_t length) {
+		using namespace detail;
+
+		if (length <= CHUNK_HEADER || hash.isEmpty())
+			return;
+
+		const uint16_t offset = readU16(data + 1);
+		const size_t size     = length - CHUNK_HEADER;
+
+		// Already have it
+		if (offset < received)
+			return;
+
+		// Only accept contiguous data, tell the phone where to continue otherwise
+		if (offset != received || offset + size > total) {
+			ack();
+			return;
+		}
+
+		memcpy(buffer + offset, data + CHUNK_HEADER, size);
+		received += size;
+
+		if (received < total)
+			return;
+
+		if (crc32(buffer, total) != crc) {
+			Serial.println("Icon checksum mismatch");
+			received = 0;
+			ack("error=crc");
+			return;
+		}
+
+		if (!Data::receiveNewIcon(hash, format, buffer, total)) {
+			Serial.println("Icon not taken, the previous one is still being handled");
+			received = 0;
+			ack("error=busy");
+			return;
+		}
+
+		ack("done=1");
+
+		hash  = String();
+		total = 0;
+		crc   = 0;
+	}
+
+	void onPacket(const uint8_t* data, size_t length) {
+		if (data[0] == PACKET_HEADER)
+			onHeader(data, length);
+		else
+			onChunk(data, length);
+	}
+} // namespace IconTransfer
+
+#endif // ICONTRANSFER_H
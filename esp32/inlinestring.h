@@ -0,0 +1,74 @@
+#ifndef INLINESTRING_H
+#define INLINESTRING_H
+
+#include "keyval.h"
+
+/**
+ * NUL terminated UTF-8 string stored inline, CAPACITY bytes at most. Longer input is cut at the
+ * last codepoint boundary that fits, so a label never shows half a character. Never allocates,
+ * and c_str() stays at the same address, which lv_label_set_text_static() relies on.
+ */
+template <size_t CAPACITY>
+class InlineString {
+  public:
+	InlineString() = default;
+
+	InlineString(const KvSpan& value) {
+		assign(value);
+	}
+
+	// Returns false if the value did not change
+	bool assign(const KvSpan& value) {
+		auto length = value.length;
+
+		if (length > CAPACITY) {
+			length = CAPACITY;
+			// Step back over continuation bytes (10xxxxxx) to the start of the cut codepoint
+			while (length > 0 && ((uint8_t)value.data[length] & 0xC0) == 0x80)
+				length--;
+		}
+
+		if (length == _length && memcmp(_data, value.data, length) == 0)
+			return false;
+
+		memcpy(_data, value.data, length);
+		_data[length] = '\0';
+		_length       = length;
+		return true;
+	}
+
+	void clear() {
+		_data[0] = '\0';
+		_length  = 0;
+	}
+
+	const char* c_str() const {
+		return _data;
+	}
+
+	size_t length() const {
+		return _length;
+	}
+
+	bool isEmpty() const {
+		return _length == 0;
+	}
+
+	KvSpan span() const {
+		return {_data, _length};
+	}
+
+	bool operator==(const KvSpan& other) const {
+		return other.length == _length && memcmp(_data, other.data, _length) == 0;
+	}
+
+	bool operator!=(const KvSpan& other) const {
+		return !(*this == other);
+	}
+
+  private:
+	char _data[CAPACITY + 1] = {};
+	size_t _length           = 0;
+};
+
+#endif // INLINESTRING_H
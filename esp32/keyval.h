@@ -1,57 +1,175 @@
-#include <algorithm>
+#ifndef KEYVAL_H
+#define KEYVAL_H
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// FNV-1a, usable in case labels to dispatch on a key hashed once
+constexpr uint32_t kvHash(const char* data, size_t length) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < length; i++)
+		hash = (hash ^ (uint8_t)data[i]) * 16777619u;
+	return hash;
+}
+
+constexpr uint32_t operator""_kv(const char* data, size_t length) {
+	return kvHash(data, length);
+}
+
+/**
+ * key=value lines parsed in place: keys and values are views into the payload, bounded by its
+ * length rather than a NUL, and nothing is allocated. The value is everything after the first '=',
+ * lines without '=' are skipped. A view is only valid as long as the payload it points into.
+ *
+ * Only the String conversions need Arduino, the parser also builds on the host (see test/).
+ */
+struct KvSpan {
+	const char* data = nullptr;
+	size_t length    = 0;
+
+	constexpr KvSpan() = default;
+
+	constexpr KvSpan(const char* data, size_t length) : data(data), length(length) {}
+
+	KvSpan(const char* str) : data(str), length(strlen(str)) {}
+
+#ifdef ARDUINO
+	KvSpan(const String& str) : data(str.c_str()), length(str.length()) {}
+#endif
+
+	bool isEmpty() const {
+		return length == 0;
+	}
+
+	// The payload may hold a NUL, it is compared as bytes
+	bool operator==(const char* other) const {
+		return strlen(other) == length && (length == 0 || memcmp(data, other, length) == 0);
+	}
+
+	bool operator!=(const char* other) const {
+		return !(*this == other);
+	}
+
+	// Same rules as String::toInt(): optional sign, then digits up to the first non digit. Values
+	// out of range saturate at LONG_MIN / LONG_MAX, like strtol().
+	long toInt() const {
+		size_t i      = 0;
+		bool negative = false;
+
+		if (i < length && (data[i] == '-' || data[i] == '+'))
+			negative = data[i++] == '-';
+
+		const unsigned long limit = negative ? (unsigned long)LONG_MAX + 1 : LONG_MAX;
+
+		unsigned long value = 0;
+		for (; i < length && data[i] >= '0' && data[i] <= '9'; i++) {
+			const unsigned digit = data[i] - '0';
+			value                = value > (limit - digit) / 10 ? limit : value * 10 + digit;
+		}
+
+		if (!negative)
+			return (long)value;
+		return value > (unsigned long)LONG_MAX ? LONG_MIN : -(long)value;
+	}
+
+	uint32_t hash() const {
+		return kvHash(data, length);
+	}
+
+#ifdef ARDUINO
+	String toString() const {
+		String result;
+		result.concat(data, length);
+		return result;
+	}
+#endif
+};
 
 struct KeyValue {
-	String key;
-	String value;
+	KvSpan key;
+	KvSpan value;
 };
 
 struct KvParseResult {
-	std::vector<KeyValue> pairs;
+	static constexpr uint8_t MAX_PAIRS = 16;
 
-	String getOrDefault(const String& key, const String& valueIfNull = "") const {
-		const auto it = std::find_if(pairs.begin(), pairs.end(), [&key](const KeyValue& kv) { return kv.key == key; });
+	KeyValue pairs[MAX_PAIRS];
+	uint8_t count = 0;
 
-		if (it != pairs.end())
-			return it->value;
-
-		return valueIfNull;
+	const KeyValue* begin() const {
+		return pairs;
 	}
 
-	bool contains(const String& key) const {
-		return std::find_if(pairs.begin(), pairs.end(), [&key](const KeyValue& kv) { return kv.key == key; }) != pairs.end();
+	const KeyValue* end() const {
+		return pairs + count;
 	}
-};
 
-std::vector<String> splitString(const String& input, const String& delimiter) {
-	std::vector<String> result;
+	const KvSpan* find(const char* key) const {
+		for (const auto& pair : *this) {
+			if (pair.key == key)
+				return &pair.value;
+		}
+		return nullptr;
+	}
 
-	int start = 0;
-	int end   = input.indexOf(delimiter);
+	bool contains(const char* key) const {
+		return find(key) != nullptr;
+	}
 
-	while (end != -1) {
-		result.push_back(input.substring(start, end));
-		start = end + delimiter.length();
-		end   = input.indexOf(delimiter, start);
+	// Empty if missing
+	KvSpan get(const char* key) const {
+		const auto value = find(key);
+		return value ? *value : KvSpan{};
 	}
 
-	result.push_back(input.substring(start));
+	long getIntOrDefault(const char* key, long valueIfNull) const {
+		const auto value = find(key);
+		return value ? value->toInt() : valueIfNull;
+	}
 
-	return result;
-}
+#ifdef ARDUINO
+	String getOrDefault(const char* key, const char* valueIfNull = "") const {
+		const auto value = find(key);
+		return value ? value->toString() : String(valueIfNull);
+	}
+#endif
+};
 
-KvParseResult kvParseMultiline(const String& input) {
+// Pairs past MAX_PAIRS are ignored
+KvParseResult kvParse(const char* data, size_t length) {
 	KvParseResult result{};
 
-	const auto lines = splitString(input, "\n");
+	const char* const end = data + length;
+	const char* line      = data;
 
-	for (const auto& line : lines) {
-		const auto parts = splitString(line, "=");
+	while (line < end && result.count < KvParseResult::MAX_PAIRS) {
+		const char* lineEnd = (const char*)memchr(line, '\n', end - line);
+		if (!lineEnd)
+			lineEnd = end;
 
-		if (parts.size() < 2)
-			continue;
+		const char* separator = (const char*)memchr(line, '=', lineEnd - line);
+		if (separator) {
+			auto& pair = result.pairs[result.count++];
+			pair.key   = {line, (size_t)(separator - line)};
+			pair.value = {separator + 1, (size_t)(lineEnd - separator - 1)};
+		}
 
-		result.pairs.push_back({parts[0], parts[1]});
+		line = lineEnd + 1;
 	}
 
 	return result;
-}
\ No newline at end of file
+}
+
+KvParseResult kvParse(const uint8_t* data, size_t length) {
+	return kvParse((const char*)data, length);
+}
+
+#ifdef ARDUINO
+KvParseResult kvParse(const String& input) {
+	return kvParse(input.c_str(), input.length());
+}
+#endif
+
+#endif // KEYVAL_H
@@ -0,0 +1,187 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include "ble.h"
+#include "inlinestring.h"
+#include "keyval.h"
+#include "memreport.h"
+
+/**
+ * End-to-end latency of navigation updates, from the BLE write to the last flushed pixel.
+ *
+ * One packet is followed at a time: its receive, dequeue, parse and apply times are stamped,
+ * then the first frame flushed after it was applied closes the measurement. Stages:
+ *   queue   received -> dequeued
+ *   parse   dequeued -> parsed
+ *   apply   parsed -> label updates done
+ *   render  applied -> first flush started (waiting for lv_timer_handler and LVGL drawing)
+ *   flush   first flush started -> last area of the frame sent over SPI
+ *   total   received -> flushed
+ *
+ * If the packet carries the phone timestamp (`ts`), `shown=<seq>\nts=<ts>\ndevice_us=<total>` is
+ * notified on CHA_NAV_SYNC so the phone can split its own end-to-end time into BLE and device.
+ * The total of every measured update is also passed to the delivery callback (e.g. ConnParams).
+ */
+namespace Latency {
+	enum Stage : uint8_t { STAGE_QUEUE, STAGE_PARSE, STAGE_APPLY, STAGE_RENDER, STAGE_FLUSH, STAGE_TOTAL, STAGE_COUNT };
+
+	namespace detail {
+		// Bucket i holds samples below FIRST_BUCKET_us << i, the last one everything above
+		constexpr uint8_t BUCKET_COUNT      = 12;
+		constexpr uint32_t FIRST_BUCKET_us  = 128;
+		constexpr uint32_t TIMEOUT_us       = 500000; // the update did not change anything visible
+		constexpr uint32_t REPORT_PERIOD_ms = 30000;
+
+		constexpr const char* STAGE_NAMES[STAGE_COUNT] = {"queue", "parse", "apply", "render", "flush", "total"};
+
+		struct Histogram {
+			uint32_t buckets[BUCKET_COUNT];
+			uint32_t count;
+			uint64_t sum_us;
+			uint32_t max_us;
+		};
+
+		enum State : uint8_t { STATE_IDLE, STATE_PROCESSING, STATE_WAITING_FLUSH, STATE_FLUSHING };
+
+		Histogram histograms[STAGE_COUNT] = {};
+		const MemoryReport::Registration histogramsRegistration{"latency", sizeof(histograms)};
+
+		State state = STATE_IDLE;
+		InlineString<8> seq;
+		InlineString<20> timestamp;
+		uint32_t received_us   = 0;
+		uint32_t dequeued_us   = 0;
+		uint32_t parsed_us     = 0;
+		uint32_t applied_us    = 0;
+		uint32_t flushStart_us = 0;
+		uint32_t lastReport_ms = 0;
+
+		void (*deliveryCallback)(uint32_t total_us) = nullptr;
+
+		void add(Stage stage, uint32_t duration_us) {
+			auto& histogram = histograms[stage];
+
+			uint8_t bucket = 0;
+			while (bucket < BUCKET_COUNT - 1 && duration_us >= FIRST_BUCKET_us << bucket)
+				bucket++;
+
+			histogram.buckets[bucket]++;
+			histogram.count++;
+			histogram.sum_us += duration_us;
+			histogram.max_us = std::max(histogram.max_us, duration_us);
+		}
+
+		void complete(uint32_t flushed_us) {
+			add(STAGE_QUEUE, dequeued_us - received_us);
+			add(STAGE_PARSE, parsed_us - dequeued_us);
+			add(STAGE_APPLY, applied_us - parsed_us);
+			add(STAGE_RENDER, flushStart_us - applied_us);
+			add(STAGE_FLUSH, flushed_us - flushStart_us);
+			add(STAGE_TOTAL, flushed_us - received_us);
+
+			if (deliveryCallback)
+				deliveryCallback(flushed_us - received_us);
+
+			if (!timestamp.isEmpty()) {
+				char message[64];
+				const auto length = snprintf(message,
+				                             sizeof(message),
+				                             "shown=%s\nts=%s\ndevice_us=%lu",
+				                             seq.c_str(),
+				                             timestamp.c_str(),
+				                             (unsigned long)(flushed_us - received_us));
+				notifyCharacteristic(CHA_NAV_SYNC, (uint8_t*)message, std::min(length, (int)sizeof(message) - 1));
+			}
+
+			state = STATE_IDLE;
+		}
+
+		void report() {
+			Serial.printf("Update latency, buckets < %luus x2^i:\n", FIRST_BUCKET_us);
+			for (uint8_t stage = 0; stage < STAGE_COUNT; stage++) {
+				const auto& histogram = histograms[stage];
+
+				Serial.printf("  %-6s avg %6luus max %6luus |",
+				              STAGE_NAMES[stage],
+				              (uint32_t)(histogram.sum_us / histogram.count),
+				              histogram.max_us);
+				for (uint8_t bucket = 0; bucket < BUCKET_COUNT; bucket++)
+					Serial.printf(" %lu", histogram.buckets[bucket]);
+				Serial.println();
+			}
+		}
+	} // namespace detail
+
+	// Called from the loop with the received -> flushed time of each measured update
+	void setDeliveryCallback(void (*callback)(uint32_t total_us)) {
+		detail::deliveryCallback = callback;
+	}
+
+	// `received_us` is stamped in the write callback, before the packet was queued
+	void onDequeued(uint32_t received_us) {
+		using namespace detail;
+
+		if (state != STATE_IDLE)
+			return;
+
+		state               = STATE_PROCESSING;
+		detail::received_us = received_us;
+		dequeued_us         = micros();
+	}
+
+	void onParsed(const KvParseResult& kv) {
+		using namespace detail;
+
+		if (state != STATE_PROCESSING)
+			return;
+
+		parsed_us = micros();
+		seq.assign(kv.get("seq"));
+		timestamp.assign(kv.get("ts"));
+	}
+
+	void onApplied() {
+		using namespace detail;
+
+		if (state != STATE_PROCESSING)
+			return;
+
+		state      = STATE_WAITING_FLUSH;
+		applied_us = micros();
+	}
+
+	// The packet was not applied (out of sequence)
+	void onDiscarded() {
+		if (detail::state == detail::STATE_PROCESSING)
+			detail::state = detail::STATE_IDLE;
+	}
+
+	// Called for every flushed area, `last` at the end of a frame
+	void onFlush(uint32_t start_us, uint32_t end_us, bool last) {
+		using namespace detail;
+
+		if (state == STATE_WAITING_FLUSH) {
+			state         = STATE_FLUSHING;
+			flushStart_us = start_us;
+		}
+
+		if (state == STATE_FLUSHING && last)
+			complete(end_us);
+	}
+
+	void update() {
+		using namespace detail;
+
+		if (state == STATE_WAITING_FLUSH && micros() - applied_us > TIMEOUT_us)
+			state = STATE_IDLE;
+
+		if (millis() - lastReport_ms < REPORT_PERIOD_ms)
+			return;
+		lastReport_ms = millis();
+
+		if (histograms[STAGE_TOTAL].count > 0)
+			report();
+	}
+} // namespace Latency
+
+#endif // LATENCY_H
@@ -0,0 +1,136 @@
+#ifndef LINKHEALTH_H
+#define LINKHEALTH_H
+
+#include "memreport.h"
+#include "ui.h"
+
+#include <algorithm>
+
+/**
+ * Flags navigation and speed data as stale when the phone stops sending, long before the BLE
+ * supervision timeout ends the connection.
+ *
+ * The last inter-arrival times of each stream are kept, a stream is stale once nothing arrived
+ * for STALE_FACTOR times their p99 and lost after LOST_FACTOR times that. Stale fields are
+ * dimmed, a lost speed is blanked. Navigation is only dimmed: the phone resends it every 25 s
+ * at most, and the last maneuver is still better than an empty screen.
+ */
+namespace LinkHealth {
+	enum Stream : uint8_t { STREAM_NAVIGATION, STREAM_SPEED, STREAM_COUNT };
+	enum State : uint8_t { STATE_FRESH, STATE_STALE, STATE_LOST };
+
+	namespace detail {
+		constexpr uint8_t SAMPLE_COUNT  = 128;
+		constexpr uint8_t MIN_SAMPLES   = 8;
+		constexpr float STALE_FACTOR    = 1.5f;
+		constexpr uint8_t LOST_FACTOR   = 3;
+		constexpr uint32_t MIN_STALE_ms = 1000;
+		constexpr uint32_t MAX_STALE_ms = 60000;
+
+		constexpr const char* STREAM_NAMES[STREAM_COUNT] = {"navigation", "speed"};
+		// Until enough samples are collected: navigation is resent every 25 s, speed comes with every GPS fix
+		constexpr uint32_t DEFAULT_STALE_ms[STREAM_COUNT] = {30000, 3000};
+
+		struct Statistics {
+			uint16_t samples[SAMPLE_COUNT]; // inter-arrival times, ms
+			uint8_t next;
+			uint8_t count;
+			uint32_t lastArrival_ms;
+			uint32_t stale_ms;
+			State state;
+		};
+
+		Statistics streams[STREAM_COUNT] = {};
+		const MemoryReport::Registration streamsRegistration{"linkHealth", sizeof(streams)};
+
+		uint32_t p99(const Statistics& stream) {
+			uint16_t sorted[SAMPLE_COUNT];
+			std::copy(stream.samples, stream.samples + stream.count, sorted);
+
+			const auto index = (stream.count * 99 + 99) / 100 - 1;
+			std::nth_element(sorted, sorted + index, sorted + stream.count);
+			return sorted[index];
+		}
+
+		void apply(Stream stream, State state) {
+			switch (stream) {
+			case STREAM_NAVIGATION: UI::setNavigationStale(state != STATE_FRESH); break;
+			case STREAM_SPEED:
+				UI::setSpeedStale(state != STATE_FRESH);
+				if (state == STATE_LOST)
+					Data::clearSpeedData();
+				break;
+			default: break;
+			}
+		}
+	} // namespace detail
+
+	void onArrival(Stream stream, uint32_t arrival_ms) {
+		auto& statistics = detail::streams[stream];
+
+		if (statistics.lastArrival_ms != 0) {
+			const auto interval_ms = std::min(arrival_ms - statistics.lastArrival_ms, (uint32_t)UINT16_MAX);
+
+			statistics.samples[statistics.next] = interval_ms;
+			statistics.next                     = (statistics.next + 1) % detail::SAMPLE_COUNT;
+			statistics.count                    = std::min<uint8_t>(statistics.count + 1, detail::SAMPLE_COUNT);
+		}
+		statistics.lastArrival_ms = arrival_ms;
+
+		if (statistics.count >= detail::MIN_SAMPLES) {
+			const auto stale_ms = (uint32_t)(detail::p99(statistics) * detail::STALE_FACTOR);
+			statistics.stale_ms = std::min(std::max(stale_ms, detail::MIN_STALE_ms), detail::MAX_STALE_ms);
+		}
+	}
+
+	State state(Stream stream) {
+		return detail::streams[stream].state;
+	}
+
+	// Keep the learned statistics, only forget the last arrival
+	void reset() {
+		for (uint8_t i = 0; i < STREAM_COUNT; i++) {
+			auto& statistics          = detail::streams[i];
+			statistics.lastArrival_ms = 0;
+
+			if (statistics.state != STATE_FRESH) {
+				statistics.state = STATE_FRESH;
+				detail::apply((Stream)i, STATE_FRESH);
+			}
+		}
+	}
+
+	void update() {
+		using namespace detail;
+
+		const auto now_ms = millis();
+		for (uint8_t i = 0; i < STREAM_COUNT; i++) {
+			auto& statistics = streams[i];
+			if (statistics.lastArrival_ms == 0)
+				continue;
+
+			const auto stale_ms = statistics.count >= MIN_SAMPLES ? statistics.stale_ms : DEFAULT_STALE_ms[i];
+			const auto age_ms   = now_ms - statistics.lastArrival_ms;
+
+			State state = STATE_FRESH;
+			if (age_ms > stale_ms * LOST_FACTOR)
+				state = STATE_LOST;
+			else if (age_ms > stale_ms)
+				state = STATE_STALE;
+
+			if (state == statistics.state)
+				continue;
+
+			Serial.printf("Link health: %s %s after %lums (threshold %lums)\n",
+			              STREAM_NAMES[i],
+			              state == STATE_FRESH ? "fresh" : state == STATE_STALE ? "stale" : "lost",
+			              age_ms,
+			              stale_ms);
+
+			statistics.state = state;
+			apply((Stream)i, state);
+		}
+	}
+} // namespace LinkHealth
+
+#endif // LINKHEALTH_H
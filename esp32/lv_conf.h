@@ -40,7 +40,12 @@
  * - LV_STDLIB_RTTHREAD:    RT-Thread implementation
  * - LV_STDLIB_CUSTOM:      Implement the functions externally
  */
+#ifdef TRACK_ALLOCATIONS
+/*Through malloc, so allocations.h can count them*/
+#define LV_USE_STDLIB_MALLOC    LV_STDLIB_CLIB
+#else
 #define LV_USE_STDLIB_MALLOC    LV_STDLIB_BUILTIN
+#endif
 #define LV_USE_STDLIB_STRING    LV_STDLIB_BUILTIN
 #define LV_USE_STDLIB_SPRINTF   LV_STDLIB_BUILTIN
 
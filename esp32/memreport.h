@@ -0,0 +1,156 @@
+#ifndef MEMREPORT_H
+#define MEMREPORT_H
+
+#include "ble.h"
+
+#include <atomic>
+#include <lvgl.h>
+
+/**
+ * Memory budget: static buffers, the LVGL pool, the system heap and task stack high-water marks.
+ *
+ * The report is printed on Serial at boot and on request (settings memoryReport=1, which also
+ * notifies it), and kept readable on CHA_MEMORY_REPORT as key=value lines, refreshed every
+ * REFRESH_PERIOD_ms. The notification is split in whole lines that fit one ATT packet at the MTU
+ * negotiated with the phone. Modules register their static buffers next to them with a Registration.
+ */
+namespace MemoryReport {
+	namespace detail {
+		constexpr uint8_t MAX_STATICS        = 24;
+		constexpr size_t REPORT_SIZE         = 512; // max ATT attribute length
+		constexpr uint32_t REFRESH_PERIOD_ms = 10000;
+		constexpr const char* TASK_NAMES[]   = {"loopTask", "storage", "BTC_TASK", "BTU_TASK", "btController", "esp_timer"};
+		constexpr uint8_t TASK_COUNT         = sizeof(TASK_NAMES) / sizeof(TASK_NAMES[0]);
+
+		struct Static {
+			const char* name;
+			size_t size;
+		};
+
+		Static statics[MAX_STATICS];
+		uint8_t staticCount = 0;
+
+		char report[REPORT_SIZE];
+		uint32_t lastRefresh_ms = 0;
+		std::atomic<bool> requested{false};
+
+		size_t staticTotal() {
+			size_t total = 0;
+			for (uint8_t i = 0; i < staticCount; i++)
+				total += statics[i].size;
+			return total;
+		}
+
+		// Compact form for BLE, formatted in place
+		size_t format() {
+			lv_mem_monitor_t lvgl;
+			lv_mem_monitor(&lvgl);
+
+			auto length = snprintf(report,
+			                       REPORT_SIZE,
+			                       "static=%u\nlvgl.total=%u\nlvgl.free=%u\nlvgl.peak=%u\nlvgl.biggest=%u\nlvgl.frag=%u\n"
+			                       "heap.total=%lu\nheap.free=%lu\nheap.min=%lu\nheap.largest=%lu",
+			                       (unsigned)staticTotal(),
+			                       (unsigned)lvgl.total_size,
+			                       (unsigned)lvgl.free_size,
+			                       (unsigned)lvgl.max_used,
+			                       (unsigned)lvgl.free_biggest_size,
+			                       lvgl.frag_pct,
+			                       (unsigned long)ESP.getHeapSize(),
+			                       (unsigned long)ESP.getFreeHeap(),
+			                       (unsigned long)ESP.getMinFreeHeap(),
+			                       (unsigned long)ESP.getMaxAllocHeap());
+
+			for (uint8_t i = 0; i < TASK_COUNT && length < (int)REPORT_SIZE; i++) {
+				const auto task = xTaskGetHandle(TASK_NAMES[i]);
+				if (!task)
+					continue;
+
+				// Bytes on ESP-IDF, where a stack word is one byte
+				length += snprintf(report + length,
+				                   REPORT_SIZE - length,
+				                   "\nstack.%s=%u",
+				                   TASK_NAMES[i],
+				                   uxTaskGetStackHighWaterMark(task));
+			}
+
+			return std::min((size_t)length, REPORT_SIZE - 1);
+		}
+
+		// Whole lines per notification, at most MTU - 3 bytes each
+		void notify(size_t length) {
+			const size_t packetMax = peerMtu - 3;
+
+			for (size_t start = 0; start < length;) {
+				size_t end = std::min(length, start + packetMax);
+				if (end < length) {
+					size_t lineEnd = end;
+					while (lineEnd > start && report[lineEnd] != '\n')
+						lineEnd--;
+					if (lineEnd > start)
+						end = lineEnd;
+				}
+
+				notifyCharacteristic(CHA_MEMORY_REPORT, (uint8_t*)report + start, end - start);
+				start = end < length && report[end] == '\n' ? end + 1 : end;
+			}
+		}
+
+		void print() {
+			Serial.println("Memory report");
+			for (uint8_t i = 0; i < staticCount; i++)
+				Serial.printf("  static.%s=%u\n", statics[i].name, (unsigned)statics[i].size);
+			Serial.println(report);
+		}
+	} // namespace detail
+
+	void addStatic(const char* name, size_t size) {
+		using namespace detail;
+
+		if (staticCount < MAX_STATICS)
+			statics[staticCount++] = {name, size};
+	}
+
+	// Defined by a module next to its static buffers, registered before setup() runs
+	struct Registration {
+		Registration(const char* name, size_t size) {
+			addStatic(name, size);
+		}
+	};
+
+	namespace detail {
+		const Registration reportRegistration{"memoryReport", sizeof(report)};
+	} // namespace detail
+
+	// From the BLE task, handled by the next update()
+	void request() {
+		detail::requested = true;
+	}
+
+	void update() {
+		using namespace detail;
+
+		const bool periodic        = millis() - lastRefresh_ms >= REFRESH_PERIOD_ms || lastRefresh_ms == 0;
+		const bool notifyRequested = requested.exchange(false);
+		if (!periodic && !notifyRequested)
+			return;
+
+		lastRefresh_ms = millis();
+
+		const auto length = format();
+		setCharacteristicValue(CHA_MEMORY_REPORT, (uint8_t*)report, length);
+
+		if (notifyRequested) {
+			print();
+			notify(length);
+		}
+	}
+
+	// Boot time report, once everything is allocated
+	void init() {
+		detail::requested = true;
+		update();
+	}
+} // namespace MemoryReport
+
+#endif // MEMREPORT_H
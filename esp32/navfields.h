@@ -0,0 +1,96 @@
+#ifndef NAVFIELDS_H
+#define NAVFIELDS_H
+
+#include "keyval.h"
+#include "telemetry.h"
+#include "ui.h"
+
+/**
+ * Dispatch of navigation packet fields: each key is hashed once and mapped to its handler through
+ * a switch on compile-time hashes. Protocol keys (seq, full, ts) are known but handled elsewhere,
+ * anything else is counted as unknown.
+ */
+namespace NavFields {
+	enum Field : uint8_t {
+		FIELD_NEXT_ROAD,
+		FIELD_NEXT_ROAD_DESC,
+		FIELD_DISTANCE_TO_NEXT,
+		FIELD_TOTAL_DISTANCE,
+		FIELD_ETA,
+		FIELD_ETE,
+		FIELD_ICON_HASH,
+		FIELD_NEXT_ICONS,
+		FIELD_SPEED,
+		FIELD_SEQ,
+		FIELD_FULL,
+		FIELD_TIMESTAMP,
+		FIELD_COUNT,
+		FIELD_UNKNOWN = FIELD_COUNT
+	};
+
+	struct Handler {
+		const char* name;
+		void (*apply)(const KvSpan& value); // nullptr for protocol keys
+	};
+
+	namespace detail {
+		constexpr Handler HANDLERS[FIELD_COUNT] = {
+		{"nextRd", [](const KvSpan& value) { Data::setNextRoad(value); }},
+		{"nextRdDesc", [](const KvSpan& value) { Data::setNextRoadDesc(value); }},
+		{"distToNext", [](const KvSpan& value) { Data::setDistanceToNextTurn(value); }},
+		{"totalDist", [](const KvSpan& value) { Data::setTotalDistance(value); }},
+		{"eta", [](const KvSpan& value) { Data::setEta(value); }},
+		{"ete", [](const KvSpan& value) { Data::setEte(value); }},
+		{"iconHash", [](const KvSpan& value) { Data::setIconHash(value); }},
+		{"nextIcons", [](const KvSpan& value) { Data::setUpcomingIcons(value); }},
+		{"speed", [](const KvSpan& value) { Data::setSpeed(value.toInt()); }},
+		{"seq", nullptr},
+		{"full", nullptr},
+		{"ts", nullptr},
+		};
+
+		Field fieldOf(const KvSpan& key) {
+			Field field;
+			switch (key.hash()) {
+			case "nextRd"_kv: field = FIELD_NEXT_ROAD; break;
+			case "nextRdDesc"_kv: field = FIELD_NEXT_ROAD_DESC; break;
+			case "distToNext"_kv: field = FIELD_DISTANCE_TO_NEXT; break;
+			case "totalDist"_kv: field = FIELD_TOTAL_DISTANCE; break;
+			case "eta"_kv: field = FIELD_ETA; break;
+			case "ete"_kv: field = FIELD_ETE; break;
+			case "iconHash"_kv: field = FIELD_ICON_HASH; break;
+			case "nextIcons"_kv: field = FIELD_NEXT_ICONS; break;
+			case "speed"_kv: field = FIELD_SPEED; break;
+			case "seq"_kv: field = FIELD_SEQ; break;
+			case "full"_kv: field = FIELD_FULL; break;
+			case "ts"_kv: field = FIELD_TIMESTAMP; break;
+			default: return FIELD_UNKNOWN;
+			}
+
+			// A different key with the same hash
+			return key == HANDLERS[field].name ? field : FIELD_UNKNOWN;
+		}
+	} // namespace detail
+
+	void apply(const KvParseResult& kv) {
+		using namespace detail;
+
+		for (const auto& pair : kv) {
+			const auto field = fieldOf(pair.key);
+
+			if (field == FIELD_UNKNOWN) {
+				const auto count = Telemetry::countUnknownKey();
+
+				// Log sparingly, a newer app would send the same key with every packet
+				if ((count & (count - 1)) == 0)
+					Serial.printf("Unknown navigation key '%.*s' (%lu so far)\n", (int)pair.key.length, pair.key.data, count);
+				continue;
+			}
+
+			if (HANDLERS[field].apply)
+				HANDLERS[field].apply(pair.value);
+		}
+	}
+} // namespace NavFields
+
+#endif // NAVFIELDS_H
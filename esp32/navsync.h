@@ -0,0 +1,87 @@
+#ifndef NAVSYNC_H
+#define NAVSYNC_H
+
+#include "allocations.h"
+#include "ble.h"
+#include "keyval.h"
+
+/**
+ * Sequence tracking for delta-encoded navigation packets.
+ *
+ * A navigation packet that carries `seq=<n>` only contains the fields that changed since the
+ * previous packet, the device state in `Data::details` is the authoritative copy. Packets
+ * without `seq` are treated as legacy full updates. When a gap in the sequence is detected the
+ * device notifies `resync=<last seq>` on CHA_NAV_SYNC and the phone answers with a full
+ * snapshot (`full=1`).
+ */
+namespace NavSync {
+	namespace detail {
+		constexpr uint32_t RESYNC_INTERVAL_ms = 1000;
+
+		bool synced                      = false;
+		uint16_t lastSeq                 = 0;
+		uint32_t lastResyncRequest_ms    = 0;
+		bool resyncRequestedSinceConnect = false;
+
+		void requestResync() {
+			// Don't flood the phone while it is still answering the previous request
+			if (resyncRequestedSinceConnect && millis() - lastResyncRequest_ms < RESYNC_INTERVAL_ms)
+				return;
+
+			resyncRequestedSinceConnect = true;
+			lastResyncRequest_ms        = millis();
+
+			// Out of sequence packets are the exception, not counted against the navigation packet
+			ALLOCATION_SCOPE("resync");
+			const auto message = String("resync=") + String(lastSeq);
+			Serial.println(message);
+			notifyCharacteristic(CHA_NAV_SYNC, (uint8_t*)message.c_str(), message.length());
+		}
+	} // namespace detail
+
+	void reset() {
+		detail::synced                      = false;
+		detail::lastSeq                     = 0;
+		detail::resyncRequestedSinceConnect = false;
+	}
+
+	// Returns false if the packet is stale and must not be applied
+	bool accept(const KvParseResult& kv) {
+		if (!kv.contains("seq"))
+			return true;
+
+		const uint16_t seq = kv.get("seq").toInt();
+
+		if (kv.contains("full")) {
+			detail::synced  = true;
+			detail::lastSeq = seq;
+			return true;
+		}
+
+		if (!detail::synced) {
+			// We have no base to apply the delta on (e.g. the device rebooted), apply what we got
+			// and ask for the rest
+			detail::lastSeq = seq;
+			detail::requestResync();
+			return true;
+		}
+
+		const uint16_t diff = seq - detail::lastSeq;
+
+		// Duplicate or reordered packet
+		if (diff == 0 || diff >= 0x8000)
+			return false;
+
+		detail::lastSeq = seq;
+
+		// At least one packet was lost, its fields may be stale now
+		if (diff > 1) {
+			detail::synced = false;
+			detail::requestResync();
+		}
+
+		return true;
+	}
+} // namespace NavSync
+
+#endif // NAVSYNC_H
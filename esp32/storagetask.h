@@ -0,0 +1,83 @@
+#ifndef STORAGETASK_H
+#define STORAGETASK_H
+
+/**
+ * Background task for flash writes, so a file system write or a sector erase does not stall
+ * rendering and the navigation queue. The work function is run every time wake() is called, it
+ * drains whatever it was given (e.g. a FixedQueue filled by the loop).
+ *
+ * The task is the only writer of the icon indexes. It holds Lock, a recursive mutex, only while it
+ * changes one (or erases flash read in place), never for file I/O, and reads them without it. The
+ * loop must not wait on a flash write: it reads under TryLock and skips the step while it is busy.
+ */
+namespace StorageTask {
+	namespace detail {
+		constexpr uint32_t STACK_SIZE = 6144; // SPIFFS needs a few KB
+
+		// Below the loop, which preempts a write as soon as it wakes. The write runs in the loop's
+		// delay() at the end of every iteration, sharing it with the idle task.
+		constexpr UBaseType_t PRIORITY = tskIDLE_PRIORITY;
+
+		TaskHandle_t task       = nullptr;
+		SemaphoreHandle_t mutex = nullptr;
+		void (*work)()          = nullptr;
+
+		void run(void*) {
+			for (;;) {
+				ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+				work();
+			}
+		}
+	} // namespace detail
+
+	class Lock {
+	  public:
+		Lock() {
+			if (detail::mutex)
+				xSemaphoreTakeRecursive(detail::mutex, portMAX_DELAY);
+		}
+
+		~Lock() {
+			if (detail::mutex)
+				xSemaphoreGiveRecursive(detail::mutex);
+		}
+	};
+
+	// Does not wait, false while the task holds Lock
+	class TryLock {
+	  public:
+		TryLock() : _locked(!detail::mutex || xSemaphoreTakeRecursive(detail::mutex, 0) == pdTRUE) {}
+
+		~TryLock() {
+			if (_locked && detail::mutex)
+				xSemaphoreGiveRecursive(detail::mutex);
+		}
+
+		explicit operator bool() const {
+			return _locked;
+		}
+
+	  private:
+		const bool _locked;
+	};
+
+	void start(void (*work)()) {
+		using namespace detail;
+
+		detail::work = work;
+		mutex        = xSemaphoreCreateRecursiveMutex();
+		if (xTaskCreate(run, "storage", STACK_SIZE, nullptr, PRIORITY, &task) != pdPASS) {
+			Serial.println("Storage task not started, writing from the loop");
+			task = nullptr;
+		}
+	}
+
+	void wake() {
+		if (detail::task)
+			xTaskNotifyGive(detail::task);
+		else if (detail::work)
+			detail::work();
+	}
+} // namespace StorageTask
+
+#endif // STORAGETASK_H
@@ -0,0 +1,172 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "ble.h"
+
+#include <lvgl.h>
+
+/**
+ * Device health, notified on CHA_TELEMETRY once per second as a packed little endian Record.
+ * Per-second values cover the last second, counters are cumulative since boot so a lost
+ * notification loses no information.
+ */
+namespace Telemetry {
+	constexpr uint8_t RECORD_VERSION = 3;
+
+	struct __attribute__((packed)) Record {
+		uint8_t version;
+		uint8_t queueDepth;      // navigation packets waiting to be processed
+		uint16_t frames;         // per second
+		uint32_t uptime_ms;
+		uint32_t flushAvg_us;    // SPI flush time per frame
+		uint32_t flushMax_us;    // per second
+		uint32_t coalesced;      // cumulative
+		uint32_t dropped;        // cumulative
+		uint32_t freeHeap;       // bytes
+		uint32_t largestBlock;   // bytes
+		uint32_t lvglFree;       // bytes
+		uint8_t lvglUsedPct;
+		uint8_t lvglFragPct;
+		uint16_t loopAvg_us;     // per second
+		uint32_t loopJitter_us;  // max - min loop period, per second
+		uint32_t unknownKeys;    // cumulative, since version 2
+		uint32_t iconHits;       // cumulative, decoded icon cache, since version 3
+		uint32_t iconMisses;     // cumulative
+		uint32_t iconEvictions;  // cumulative
+	};
+
+	// Cumulative since boot, for benchmarks over a longer period
+	struct Totals {
+		uint32_t frames;
+		uint64_t flush_us;
+		uint32_t coalesced;
+		uint32_t dropped;
+	};
+
+	namespace detail {
+		uint32_t totalFrames   = 0;
+		uint64_t totalFlush_us = 0;
+
+		uint32_t frames        = 0;
+		uint32_t frameFlush_us = 0;
+		uint32_t flushTotal_us = 0;
+		uint32_t flushMax_us   = 0;
+		uint32_t coalesced     = 0;
+		uint32_t dropped       = 0;
+		uint32_t unknownKeys   = 0;
+		uint32_t iconHits      = 0;
+		uint32_t iconMisses    = 0;
+		uint32_t iconEvictions = 0;
+
+		uint32_t lastLoop_us = 0;
+		uint32_t loops       = 0;
+		uint32_t loopMin_us  = UINT32_MAX;
+		uint32_t loopMax_us  = 0;
+
+		uint32_t lastReport_ms = 0;
+	} // namespace detail
+
+	// Called for every flushed area, `last` at the end of a frame
+	void onFlush(uint32_t duration_us, bool last) {
+		using namespace detail;
+
+		frameFlush_us += duration_us;
+		if (!last)
+			return;
+
+		frames++;
+		flushTotal_us += frameFlush_us;
+		totalFrames++;
+		totalFlush_us += frameFlush_us;
+		flushMax_us   = std::max(flushMax_us, frameFlush_us);
+		frameFlush_us = 0;
+	}
+
+	void onLoop() {
+		using namespace detail;
+
+		const auto now_us = micros();
+		if (lastLoop_us != 0) {
+			const auto period_us = now_us - lastLoop_us;
+			loops++;
+			loopMin_us = std::min(loopMin_us, period_us);
+			loopMax_us = std::max(loopMax_us, period_us);
+		}
+		lastLoop_us = now_us;
+	}
+
+	void countCoalesced() {
+		detail::coalesced++;
+	}
+
+	void countDropped() {
+		detail::dropped++;
+	}
+
+	// Returns the count so far
+	uint32_t countUnknownKey() {
+		return ++detail::unknownKeys;
+	}
+
+	void countIconHit() {
+		detail::iconHits++;
+	}
+
+	void countIconMiss() {
+		detail::iconMisses++;
+	}
+
+	void countIconEviction() {
+		detail::iconEvictions++;
+	}
+
+	Totals totals() {
+		return {detail::totalFrames, detail::totalFlush_us, detail::coalesced, detail::dropped};
+	}
+
+	void update(size_t queueDepth) {
+		using namespace detail;
+
+		const auto now_ms = millis();
+		if (now_ms - lastReport_ms < 1000)
+			return;
+
+		const auto elapsed_ms = now_ms - lastReport_ms;
+		lastReport_ms         = now_ms;
+
+		lv_mem_monitor_t lvgl;
+		lv_mem_monitor(&lvgl);
+
+		Record record{};
+		record.version       = RECORD_VERSION;
+		record.queueDepth    = std::min(queueDepth, (size_t)UINT8_MAX);
+		record.frames        = frames;
+		record.uptime_ms     = now_ms;
+		record.flushAvg_us   = frames ? flushTotal_us / frames : 0;
+		record.flushMax_us   = flushMax_us;
+		record.coalesced     = coalesced;
+		record.dropped       = dropped;
+		record.freeHeap      = ESP.getFreeHeap();
+		record.largestBlock  = ESP.getMaxAllocHeap();
+		record.lvglFree      = lvgl.free_size;
+		record.lvglUsedPct   = lvgl.used_pct;
+		record.lvglFragPct   = lvgl.frag_pct;
+		record.loopAvg_us    = loops ? std::min(elapsed_ms * 1000 / loops, (uint32_t)UINT16_MAX) : 0;
+		record.loopJitter_us = loops ? loopMax_us - loopMin_us : 0;
+		record.unknownKeys   = unknownKeys;
+		record.iconHits      = iconHits;
+		record.iconMisses    = iconMisses;
+		record.iconEvictions = iconEvictions;
+
+		notifyCharacteristic(CHA_TELEMETRY, (uint8_t*)&record, sizeof(record));
+
+		frames        = 0;
+		flushTotal_us = 0;
+		flushMax_us   = 0;
+		loops         = 0;
+		loopMin_us    = UINT32_MAX;
+		loopMax_us    = 0;
+	}
+} // namespace Telemetry
+
+#endif // TELEMETRY_H
@@ -0,0 +1,29 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <algorithm>
+#include <chrono>
+
+namespace Bench {
+	// Mean ns per call of `body`, repeated for at least `minimum_ms`
+	template <typename Body> double measure(Body&& body, double minimum_ms = 100) {
+		using Clock = std::chrono::steady_clock;
+
+		// Batches grow to 1000 calls, slow bodies (a whole boot) stop after a few
+		long calls       = 0;
+		long batch       = 1;
+		const auto start = Clock::now();
+		double elapsed_ns;
+		do {
+			for (long i = 0; i < batch; i++)
+				body();
+			calls += batch;
+			batch      = std::min(batch * 2, 1000L);
+			elapsed_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+		} while (elapsed_ns < minimum_ms * 1e6);
+
+		return elapsed_ns / calls;
+	}
+} // namespace Bench
+
+#endif // BENCH_H
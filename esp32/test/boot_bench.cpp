@@ -0,0 +1,82 @@
+// Boot cost of the icon cache at 50 and 500 icons and full: IconFiles (iconfiles.h) from its index
+// file and from the directory listing it falls back to, and the scan of the IconStore (iconstore.h)
+// partition. Host time, with the file system operations and flash reads that set the device time.
+//
+// Neither backend holds thousands of icons: IconFiles indexes 3/4 of its INDEX_SLOTS (768) and
+// IconStore keeps LIVE_LIMIT records (1024) at most, fewer once 3/4 of its partition is live. The last
+// run writes that many icons to each, more would only measure eviction.
+
+#include "host/firmware.h"
+
+#include "bench.h"
+#include "iconfiles.h"
+#include "iconstore.h"
+#include "icons.h"
+
+#include <stdio.h>
+
+constexpr size_t FS_SIZE          = 64 * 1024 * 1024; // evicts on the index only
+constexpr size_t PARTITION_SIZE   = 0x100000;         // the icons partition of partitions.csv
+constexpr uint32_t FILES_CAPACITY = decltype(IconFiles::detail::index)::capacity();
+constexpr uint32_t STORE_CAPACITY = IconStore::detail::LIVE_LIMIT;
+
+static void files(uint32_t icons) {
+	HostFs::reset(FS_SIZE);
+	IconFiles::init();
+	for (uint32_t i = 0; i < icons; i++) {
+		const auto data = Icons::payload(i, Icons::length(i));
+		IconFiles::write(Icons::hash(i), 3, data.data(), data.size());
+	}
+	IconFiles::saveIndex();
+
+	HostFs::resetCounters();
+	IconFiles::init();
+	const auto opened = HostFs::opened;
+	const auto read   = HostFs::read;
+	const auto fromIndex = Bench::measure([]() { IconFiles::init(); }, 20);
+
+	HostFs::resetCounters();
+	SPIFFS.remove("/index.dat");
+	IconFiles::init();
+	const auto listed  = HostFs::listed;
+	const auto fromDirectory = Bench::measure([]() {
+		SPIFFS.remove("/index.dat");
+		IconFiles::init();
+	}, 20);
+
+	printf("%5u icons  files: index file %8.1f us (%llu open, %5.1f KB read) | directory %8.1f us (%llu entries) | %u indexed\n",
+	       (unsigned)icons,
+	       fromIndex / 1000,
+	       (unsigned long long)opened,
+	       read / 1024.0,
+	       fromDirectory / 1000,
+	       (unsigned long long)listed,
+	       (unsigned)IconFiles::count());
+}
+
+static void store(uint32_t icons) {
+	HostFlash::reset(PARTITION_SIZE);
+	IconStore::init();
+	for (uint32_t i = 0; i < icons; i++) {
+		const auto data = Icons::payload(i, Icons::length(i));
+		IconStore::append(Icons::hash(i), 3, data.data(), data.size());
+	}
+
+	const auto scan = Bench::measure([]() { IconStore::init(); }, 20);
+	printf("%5u icons  store: scan %8.1f us (%u KB partition) | %u held\n",
+	       (unsigned)icons,
+	       scan / 1000,
+	       (unsigned)(PARTITION_SIZE / 1024),
+	       (unsigned)IconStore::count());
+}
+
+int main() {
+	for (uint32_t icons : {50, 500}) {
+		files(icons);
+		store(icons);
+	}
+
+	files(FILES_CAPACITY);
+	store(STORE_CAPACITY);
+	return 0;
+}
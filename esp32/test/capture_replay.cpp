@@ -0,0 +1,234 @@
+// Capture and replay (capture.h) on the host: navigation packets recorded through LiveWrite, replayed
+// by Capture::update() into the navigation queue and processed as processQueue() does (esp32.ino).
+// Live writes are dropped during a replay, and one accepted just before it holds the replay back
+// until it ends, so the queue keeps one producer.
+//
+//   capture_replay               the tests
+//   capture_replay <log> [log]   replays capture logs copied from the device (/capture0.log and
+//                                /capture1.log) as fast as it goes, and prints what they held
+//
+// The loop here drains the queue after each replay burst, the device takes one packet per loop.
+
+#include "host/firmware.h"
+
+#include "host/navigation.h"
+
+#include "capture.h"
+#include "fixedqueue.h"
+#include "navfields.h"
+#include "navsync.h"
+#include "test.h"
+
+#include <chrono>
+
+struct NavigationPacket {
+	uint8_t data[512];
+	size_t length;
+};
+
+static FixedQueue<NavigationPacket, 16> navigationQueue;
+
+static uint32_t navigationPackets = 0;
+static uint32_t applied           = 0;
+static uint32_t stale             = 0;
+static uint32_t icons             = 0;
+static size_t maxQueueDepth       = 0;
+static double process_ns          = 0;
+
+// The streams capture.h records, as esp32.ino handles them
+void applyWrite(const String& uuid, uint8_t* data, size_t length) {
+	if (uuid == CHA_NAV) {
+		navigationPackets++;
+
+		const auto packet = navigationQueue.prepare();
+		if (packet && length <= sizeof(packet->data)) {
+			memcpy(packet->data, data, length);
+			packet->length = length;
+			navigationQueue.commit();
+		} else {
+			Telemetry::countDropped();
+		}
+	}
+
+	if (uuid == CHA_NAV_TBT_ICON)
+		icons++;
+
+	if (uuid == CHA_GPS_SPEED)
+		Data::setSpeed(KvSpan((char*)data, length).toInt());
+}
+
+static void processQueue() {
+	using Clock = std::chrono::steady_clock;
+
+	maxQueueDepth = std::max(maxQueueDepth, navigationQueue.size());
+
+	const auto start = Clock::now();
+	while (!navigationQueue.empty()) {
+		const auto& packet = navigationQueue.front();
+		const auto kv      = kvParse(packet.data, packet.length);
+
+		if (NavSync::accept(kv)) {
+			NavFields::apply(kv);
+			applied++;
+		} else {
+			stale++;
+		}
+		navigationQueue.pop();
+	}
+	process_ns += std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+// onCharacteristicWrite() from the BLE task, false if the write was dropped
+static bool liveWrite(const char* uuid, const char* payload) {
+	const Capture::LiveWrite write(uuid, (const uint8_t*)payload, strlen(payload));
+	if (!write)
+		return false;
+
+	applyWrite(uuid, (uint8_t*)payload, strlen(payload));
+	return true;
+}
+
+static void replay() {
+	Capture::startReplay(0);
+	while (Capture::isReplaying()) {
+		Capture::update(navigationQueue.size());
+		processQueue();
+	}
+}
+
+static void reset() {
+	NavSync::reset();
+	Data::clear();
+}
+
+static const char* const RIDE[] = {
+"seq=17\nfull=1\nnextRd=Nguyen Van Linh\nnextRdDesc=toward Phu My Bridge\ndistToNext=450 m\neta=08:42\n"
+"ete=21 min\ntotalDist=12.4 km\niconHash=3fa91c07d2",
+"seq=18\ndistToNext=400 m",
+"seq=19\ndistToNext=350 m\ntotalDist=12.3 km",
+"seq=19\ndistToNext=350 m\ntotalDist=12.3 km",
+"seq=20\nnextRd=Duong Nguyen Huu Tho\ndistToNext=1.2 km\niconHash=8e0b44a1c9",
+};
+static constexpr uint32_t RIDE_LENGTH = sizeof(RIDE) / sizeof(RIDE[0]);
+
+// Records the ride, the replay leaves the same state behind
+static void roundTrip() {
+	HostFs::reset(0x100000);
+	reset();
+
+	Capture::startCapture();
+	for (const auto packet : RIDE) {
+		CHECK(liveWrite(CHA_NAV, packet));
+		processQueue();
+	}
+	CHECK(liveWrite(CHA_GPS_SPEED, "57"));
+	CHECK(liveWrite(CHA_SETTINGS, "lightTheme=true"));
+	Capture::stopCapture();
+
+	CHECK(Data::details::nextRoad == "Duong Nguyen Huu Tho");
+	CHECK(stale == 1);
+
+	reset();
+	navigationPackets = 0;
+	applied           = 0;
+	replay();
+
+	CHECK(Capture::detail::replayedRecords == RIDE_LENGTH + 1);
+	CHECK(navigationPackets == RIDE_LENGTH && applied == RIDE_LENGTH - 1);
+	CHECK(Data::details::nextRoad == "Duong Nguyen Huu Tho");
+	CHECK(Data::details::nextRoadDesc == "toward Phu My Bridge");
+	CHECK(Data::details::distanceToNextTurn == "1.2 km");
+	CHECK(Data::details::totalDistance == "12.3 km");
+	CHECK(Data::details::displayIconHash == "8e0b44a1c9");
+	CHECK(Data::details::speed == 57);
+}
+
+// The log of roundTrip(): live packets never reach the queue the replay fills
+static void liveWritesDropped() {
+	reset();
+	Capture::startReplay(0);
+
+	CHECK(!liveWrite(CHA_NAV, "nextRd=Live road"));
+	CHECK(!liveWrite(CHA_GPS_SPEED, "12"));
+	CHECK(liveWrite(CHA_SETTINGS, "lightTheme=false"));
+
+	while (Capture::isReplaying()) {
+		CHECK(!liveWrite(CHA_NAV, "nextRd=Live road"));
+		Capture::update(navigationQueue.size());
+		processQueue();
+	}
+
+	CHECK(Data::details::nextRoad == "Duong Nguyen Huu Tho");
+	CHECK(Data::details::speed == 57);
+	CHECK(liveWrite(CHA_NAV, "nextRd=Live road"));
+	processQueue();
+	CHECK(Data::details::nextRoad == "Live road");
+}
+
+// A live write accepted before the replay started ends before the replay dispatches
+static void replayWaitsForLiveWrite() {
+	reset();
+	{
+		const char payload[] = "seq=1\nfull=1\nnextRd=Live road";
+		const Capture::LiveWrite write(CHA_NAV, (const uint8_t*)payload, strlen(payload));
+		CHECK(write);
+
+		Capture::startReplay(0);
+		Capture::update(navigationQueue.size());
+		CHECK(Capture::detail::replayedRecords == 0);
+
+		applyWrite(CHA_NAV, (uint8_t*)payload, strlen(payload));
+	}
+
+	processQueue();
+	CHECK(Data::details::nextRoad == "Live road");
+
+	replay();
+	CHECK(Capture::detail::replayedRecords == RIDE_LENGTH + 1);
+	CHECK(Data::details::nextRoad == "Duong Nguyen Huu Tho");
+}
+
+static bool load(const char* path, const char* name) {
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		perror(path);
+		return false;
+	}
+
+	auto data = std::make_shared<std::vector<uint8_t>>();
+	for (int c; (c = fgetc(file)) != EOF;)
+		data->push_back(c);
+	fclose(file);
+
+	HostFs::files[name] = data;
+	return true;
+}
+
+int main(int argc, char** argv) {
+	if (argc == 1) {
+		RUN(roundTrip);
+		RUN(liveWritesDropped);
+		RUN(replayWaitsForLiveWrite);
+		return 0;
+	}
+
+	HostFs::reset(0x100000);
+	for (int i = 1; i < argc && i <= 2; i++) {
+		if (!load(argv[i], Capture::detail::FILES[i - 1]))
+			return 1;
+	}
+
+	replay();
+	printf("%lu records: %lu navigation packets (%lu applied, %lu stale, %lu dropped), %lu icon packets, "
+	       "speed %d | max queue %u, process %.1f ns/packet\n",
+	       (unsigned long)Capture::detail::replayedRecords,
+	       (unsigned long)navigationPackets,
+	       (unsigned long)applied,
+	       (unsigned long)stale,
+	       (unsigned long)Telemetry::dropped,
+	       (unsigned long)icons,
+	       Data::details::speed,
+	       (unsigned)maxQueueDepth,
+	       navigationPackets ? process_ns / navigationPackets : 0);
+	return 0;
+}
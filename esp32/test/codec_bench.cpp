@@ -0,0 +1,90 @@
+// PackBits (iconcodec.h) on turn arrows drawn like the phone's icons (icons.h), in each bitmap
+// format: the size the phone sends against the raw bitmap, and the decode time per icon against a
+// plain copy of the raw one. The encoder is the phone's (BitmapHelper.packBits in the Android app).
+
+#include "bench.h"
+#include "iconcodec.h"
+#include "icons.h"
+#include "test.h"
+
+#include <stdio.h>
+
+constexpr uint32_t CORPUS = 72; // every angle, in every stroke width
+
+static std::vector<uint8_t> packBits(const std::vector<uint8_t>& data) {
+	std::vector<uint8_t> out;
+	size_t i = 0;
+
+	while (i < data.size()) {
+		// Repeated byte
+		size_t run = 1;
+		while (i + run < data.size() && run < 128 && data[i + run] == data[i])
+			run++;
+		if (run >= 2) {
+			out.push_back(1 - run);
+			out.push_back(data[i]);
+			i += run;
+			continue;
+		}
+
+		// Literal bytes, until the next repeat
+		const size_t start = i;
+		while (i < data.size() && i - start < 128) {
+			if (i + 1 < data.size() && data[i] == data[i + 1])
+				break;
+			i++;
+		}
+		out.push_back(i - start - 1);
+		out.insert(out.end(), data.begin() + start, data.begin() + i);
+	}
+
+	return out;
+}
+
+static void run(const char* name, uint8_t bitsPerPixel, uint8_t rawFormat, uint8_t packedFormat) {
+	std::vector<std::vector<uint8_t>> raw, packed;
+	size_t rawTotal = 0, packedTotal = 0, packedMax = 0;
+
+	for (uint32_t i = 0; i < CORPUS; i++) {
+		raw.push_back(Icons::arrow(i, bitsPerPixel));
+		packed.push_back(packBits(raw.back()));
+		rawTotal += raw.back().size();
+		packedTotal += packed.back().size();
+		packedMax = std::max(packedMax, packed.back().size());
+	}
+
+	static uint8_t bitmap[Icons::SIZE * Icons::SIZE / 2];
+	const size_t expected = raw[0].size();
+
+	// The device decodes into its render buffer, here a plain bitmap
+	uint32_t next = 0;
+	const auto decode = [&](uint8_t format, const std::vector<std::vector<uint8_t>>& corpus) {
+		const auto& data = corpus[next++ % CORPUS];
+		size_t out       = 0;
+		CHECK(IconCodec::decode(format, data.data(), data.size(), expected, [&out](uint8_t byte) { bitmap[out++] = byte; }));
+	};
+
+	for (uint32_t i = 0; i < CORPUS; i++) {
+		decode(packedFormat, packed);
+		CHECK(memcmp(bitmap, raw[i].data(), expected) == 0);
+	}
+
+	const auto packed_ns = Bench::measure([&]() { decode(packedFormat, packed); });
+	const auto raw_ns    = Bench::measure([&]() { decode(rawFormat, raw); });
+
+	printf("%-4s %4u B raw, PackBits %6.1f B avg (max %4u) ratio %5.2f | decode %7.1f ns/icon, raw copy %7.1f ns\n",
+	       name,
+	       (unsigned)expected,
+	       (double)packedTotal / CORPUS,
+	       (unsigned)packedMax,
+	       (double)rawTotal / packedTotal,
+	       packed_ns,
+	       raw_ns);
+}
+
+int main() {
+	run("1bpp", 1, IconCodec::FORMAT_1BPP, IconCodec::FORMAT_1BPP_PACKBITS);
+	run("2bpp", 2, IconCodec::FORMAT_2BPP, IconCodec::FORMAT_2BPP_PACKBITS);
+	run("I4", 4, IconCodec::FORMAT_I4, IconCodec::FORMAT_I4_PACKBITS);
+	return 0;
+}
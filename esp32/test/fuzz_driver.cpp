@@ -0,0 +1,55 @@
+// Runs a fuzz target without libFuzzer: the files given on the command line, or pseudo-random
+// payloads built from the separators the parsers care about.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+int main(int argc, char** argv) {
+	if (argc > 1) {
+		for (int i = 1; i < argc; i++) {
+			FILE* file = fopen(argv[i], "rb");
+			if (!file) {
+				perror(argv[i]);
+				return 1;
+			}
+
+			std::vector<uint8_t> data;
+			for (int c; (c = fgetc(file)) != EOF;)
+				data.push_back(c);
+			fclose(file);
+
+			LLVMFuzzerTestOneInput(data.data(), data.size());
+		}
+		return 0;
+	}
+
+	static const char ALPHABET[] = "==\n\n\0\0-+0123456789aefinqstx,;";
+	const long runs = getenv("FUZZ_RUNS") ? atol(getenv("FUZZ_RUNS")) : 200000;
+
+	uint32_t seed = 1;
+	const auto next = [&seed]() {
+		seed = seed * 1103515245 + 12345;
+		return seed >> 16;
+	};
+
+	std::vector<uint8_t> data;
+	for (long run = 0; run < runs; run++) {
+		data.resize(next() % 64 ? next() % 48 : next() % 600);
+		for (auto& byte : data)
+			byte = next() % 8 ? ALPHABET[next() % (sizeof(ALPHABET) - 1)] : next();
+
+		// Numbers longer than a long holds, as a corrupt or hostile value would be
+		if (!data.empty() && next() % 4 == 0) {
+			for (size_t i = next() % data.size(), digits = next() % 32; i < data.size() && digits > 0; i++, digits--)
+				data[i] = '0' + next() % 10;
+		}
+		LLVMFuzzerTestOneInput(data.data(), data.size());
+	}
+
+	printf("%ld inputs\n", runs);
+	return 0;
+}
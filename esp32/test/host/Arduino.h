@@ -0,0 +1,172 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// The part of the Arduino core used by the modules built on the host: String, Serial, time and
+// the FreeRTOS calls of storagetask.h. The host runs one task, locks and critical sections are no-ops.
+
+#include <algorithm>
+#include <chrono>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#define ARDUINO 10819
+
+class String {
+  public:
+	String(const char* str = "") : _value(str ? str : "") {}
+	String(const std::string& str) : _value(str) {}
+	explicit String(long value) : _value(std::to_string(value)) {}
+
+	const char* c_str() const {
+		return _value.c_str();
+	}
+
+	size_t length() const {
+		return _value.size();
+	}
+
+	bool isEmpty() const {
+		return _value.empty();
+	}
+
+	void reserve(size_t size) {
+		_value.reserve(size);
+	}
+
+	bool concat(const char* data, size_t length) {
+		_value.append(data, length);
+		return true;
+	}
+
+	bool endsWith(const String& suffix) const {
+		return _value.size() >= suffix._value.size() &&
+		       _value.compare(_value.size() - suffix._value.size(), suffix._value.size(), suffix._value) == 0;
+	}
+
+	String substring(size_t begin, size_t end) const {
+		return _value.substr(begin, end - begin);
+	}
+
+	String& operator+=(const String& other) {
+		_value += other._value;
+		return *this;
+	}
+
+	String& operator+=(char c) {
+		_value += c;
+		return *this;
+	}
+
+	friend String operator+(const String& a, const String& b) {
+		return a._value + b._value;
+	}
+
+	friend String operator+(const String& a, const char* b) {
+		return a._value + b;
+	}
+
+	friend String operator+(const char* a, const String& b) {
+		return a + b._value;
+	}
+
+	bool operator==(const String& other) const {
+		return _value == other._value;
+	}
+
+	bool operator==(const char* other) const {
+		return _value == other;
+	}
+
+	bool operator!=(const String& other) const {
+		return _value != other._value;
+	}
+
+	bool operator<(const String& other) const {
+		return _value < other._value;
+	}
+
+  private:
+	std::string _value;
+};
+
+// Quiet unless HOST_VERBOSE is set, the firmware logs are not what a test checks
+struct HostSerial {
+	bool verbose = getenv("HOST_VERBOSE") != nullptr;
+
+	int printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+		if (!verbose)
+			return 0;
+		va_list args;
+		va_start(args, format);
+		const int length = vprintf(format, args);
+		va_end(args);
+		return length;
+	}
+
+	void print(const char* text) {
+		if (verbose)
+			fputs(text, stdout);
+	}
+
+	void println(const char* text = "") {
+		if (verbose)
+			puts(text);
+	}
+
+	void println(const String& text) {
+		println(text.c_str());
+	}
+};
+
+inline HostSerial Serial;
+
+inline unsigned long micros() {
+	using namespace std::chrono;
+	static const auto start = steady_clock::now();
+	return duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+inline unsigned long millis() {
+	return micros() / 1000;
+}
+
+typedef void* TaskHandle_t;
+typedef void* SemaphoreHandle_t;
+typedef unsigned UBaseType_t;
+typedef int BaseType_t;
+
+#define pdTRUE           1
+#define pdPASS           1
+#define portMAX_DELAY    0xFFFFFFFF
+#define tskIDLE_PRIORITY 0
+
+inline SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() {
+	return nullptr;
+}
+inline BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t, uint32_t) {
+	return pdTRUE;
+}
+inline BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t) {
+	return pdTRUE;
+}
+inline BaseType_t xTaskCreate(void (*)(void*), const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*) {
+	return 0;
+}
+inline uint32_t ulTaskNotifyTake(BaseType_t, uint32_t) {
+	return 0;
+}
+inline void xTaskNotifyGive(TaskHandle_t) {}
+inline TaskHandle_t xTaskGetCurrentTaskHandle() {
+	static int task;
+	return &task;
+}
+
+struct portMUX_TYPE {};
+#define portMUX_INITIALIZER_UNLOCKED {}
+#define portENTER_CRITICAL(mux) (void)(mux)
+#define portEXIT_CRITICAL(mux)  (void)(mux)
+
+#endif // HOST_ARDUINO_H
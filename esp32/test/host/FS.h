@@ -0,0 +1,169 @@
+#ifndef HOST_FS_H
+#define HOST_FS_H
+
+// In-memory file system behind the Arduino FS API (flat, like SPIFFS), for IconFiles on the host.
+// HostFs counts the operations that reach flash on the device; the time of each depends on the file
+// system and is not modelled.
+
+#include "Arduino.h"
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#define FILE_READ   "r"
+#define FILE_WRITE  "w"
+#define FILE_APPEND "a"
+
+namespace HostFs {
+	using Data = std::shared_ptr<std::vector<uint8_t>>;
+
+	constexpr size_t PAGE_SIZE = 256; // SPIFFS allocates whole pages
+
+	inline std::map<std::string, Data> files;
+	inline size_t capacity = 0;
+
+	// Since the last reset()
+	inline uint64_t opened  = 0; // files opened, directory included
+	inline uint64_t read    = 0; // bytes
+	inline uint64_t written = 0; // bytes
+	inline uint64_t listed  = 0; // directory entries
+
+	inline void resetCounters() {
+		opened  = 0;
+		read    = 0;
+		written = 0;
+		listed  = 0;
+	}
+
+	// Empty file system of `size` bytes
+	inline void reset(size_t size) {
+		files.clear();
+		capacity = size;
+		resetCounters();
+	}
+} // namespace HostFs
+
+class File {
+  public:
+	File() = default;
+
+	// Regular file
+	File(const std::string& path, HostFs::Data data) : _path(path), _data(std::move(data)) {}
+
+	// Directory: the names it held when opened
+	explicit File(std::vector<std::string> entries) : _path("/"), _entries(std::move(entries)), _directory(true) {}
+
+	explicit operator bool() const {
+		return _directory || _data != nullptr;
+	}
+
+	size_t size() const {
+		return _data ? _data->size() : 0;
+	}
+
+	size_t read(uint8_t* buffer, size_t length) {
+		if (!_data)
+			return 0;
+		length = std::min(length, _data->size() - _position);
+		memcpy(buffer, _data->data() + _position, length);
+		_position += length;
+		HostFs::read += length;
+		return length;
+	}
+
+	size_t write(const uint8_t* buffer, size_t length) {
+		if (!_data)
+			return 0;
+		_data->insert(_data->end(), buffer, buffer + length);
+		HostFs::written += length;
+		return length;
+	}
+
+	void close() {
+		_data.reset();
+	}
+
+	const char* path() const {
+		return _path.c_str();
+	}
+
+	const char* name() const {
+		return _path.c_str() + _path.rfind('/') + 1;
+	}
+
+	// Entries removed since the directory was opened are skipped
+	File openNextFile() {
+		while (_next < _entries.size()) {
+			const auto found = HostFs::files.find(_entries[_next++]);
+			HostFs::listed++;
+			if (found != HostFs::files.end())
+				return File(found->first, found->second);
+		}
+		return File();
+	}
+
+  private:
+	std::string _path;
+	HostFs::Data _data;
+	size_t _position = 0;
+	std::vector<std::string> _entries;
+	size_t _next    = 0;
+	bool _directory = false;
+};
+
+class FS {
+  public:
+	bool begin(bool = false) {
+		return true;
+	}
+
+	File open(const String& path, const char* mode = FILE_READ) {
+		HostFs::opened++;
+
+		if (path == "/") {
+			std::vector<std::string> entries;
+			for (const auto& file : HostFs::files)
+				entries.push_back(file.first);
+			return File(std::move(entries));
+		}
+
+		const std::string name = path.c_str();
+		if (strcmp(mode, FILE_WRITE) == 0) {
+			auto& data = HostFs::files[name];
+			data       = std::make_shared<std::vector<uint8_t>>();
+			return File(name, data);
+		}
+
+		if (strcmp(mode, FILE_APPEND) == 0) {
+			auto& data = HostFs::files[name];
+			if (!data)
+				data = std::make_shared<std::vector<uint8_t>>();
+			return File(name, data);
+		}
+
+		const auto found = HostFs::files.find(name);
+		return found == HostFs::files.end() ? File() : File(name, found->second);
+	}
+
+	bool exists(const String& path) {
+		return HostFs::files.count(path.c_str()) > 0;
+	}
+
+	bool remove(const String& path) {
+		return HostFs::files.erase(path.c_str()) > 0;
+	}
+
+	size_t usedBytes() {
+		size_t used = 0;
+		for (const auto& file : HostFs::files)
+			used += (file.second->size() / HostFs::PAGE_SIZE + 1) * HostFs::PAGE_SIZE;
+		return used;
+	}
+
+	size_t totalBytes() {
+		return HostFs::capacity;
+	}
+};
+
+#endif // HOST_FS_H
@@ -0,0 +1,122 @@
+#ifndef HOST_ESP_PARTITION_H
+#define HOST_ESP_PARTITION_H
+
+// Emulated NOR flash behind the esp_partition API: programming can only clear bits, erasing sets
+// whole 4 KB sectors back to 0xFF. HostFlash sets up the partition and counts what reached flash.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+typedef int esp_err_t;
+typedef uint32_t esp_partition_mmap_handle_t;
+
+#define ESP_OK                   0
+#define ESP_FAIL                 -1
+#define ESP_PARTITION_TYPE_DATA  1
+#define ESP_PARTITION_SUBTYPE_ANY 0xFF
+#define ESP_PARTITION_MMAP_DATA  0
+
+struct esp_partition_t {
+	uint32_t address;
+	uint32_t size;
+	const char* label;
+};
+
+namespace HostFlash {
+	constexpr size_t SECTOR_SIZE = 4096;
+
+	inline std::vector<uint8_t> image;
+	inline esp_partition_t partition = {0, 0, "icons"};
+
+	// Since the last reset()
+	inline uint64_t programmed = 0; // bytes
+	inline uint64_t erased     = 0; // sectors
+	inline long budget         = -1; // bytes left to program before a power cut, -1 for none
+
+	// Erased (or filled with `fill`) partition of `size` bytes, no partition when 0
+	inline void reset(size_t size, uint8_t fill = 0xFF) {
+		image.assign(size, fill);
+		partition.size = size;
+		programmed     = 0;
+		erased         = 0;
+		budget         = -1;
+	}
+
+	// Whatever an earlier user of the partition left, e.g. an old SPIFFS
+	inline void scramble(uint32_t seed) {
+		for (auto& byte : image) {
+			seed = seed * 1103515245 + 12345;
+			byte = seed >> 16;
+		}
+	}
+
+	// Programming stops after `bytes` more bytes, as if the power was cut
+	inline void cutPowerAfter(long bytes) {
+		budget = bytes;
+	}
+
+	inline bool save(const char* path) {
+		FILE* file = fopen(path, "wb");
+		if (!file)
+			return false;
+		const bool written = fwrite(image.data(), 1, image.size(), file) == image.size();
+		return fclose(file) == 0 && written;
+	}
+
+	inline bool load(const char* path) {
+		FILE* file = fopen(path, "rb");
+		if (!file)
+			return false;
+		fseek(file, 0, SEEK_END);
+		reset(ftell(file));
+		fseek(file, 0, SEEK_SET);
+		const bool read = fread(image.data(), 1, image.size(), file) == image.size();
+		fclose(file);
+		return read;
+	}
+} // namespace HostFlash
+
+inline const esp_partition_t* esp_partition_find_first(int, int, const char* label) {
+	return HostFlash::partition.size && strcmp(label, HostFlash::partition.label) == 0 ? &HostFlash::partition : nullptr;
+}
+
+inline esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size, int, const void** pointer,
+                                    esp_partition_mmap_handle_t* handle) {
+	if (offset + size > partition->size)
+		return ESP_FAIL;
+	*pointer = HostFlash::image.data() + offset;
+	*handle  = 0;
+	return ESP_OK;
+}
+
+inline esp_err_t esp_partition_write(const esp_partition_t* partition, size_t offset, const void* data, size_t size) {
+	if (offset + size > partition->size)
+		return ESP_FAIL;
+
+	const auto* bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < size; i++) {
+		if (HostFlash::budget == 0)
+			return ESP_FAIL;
+		if (HostFlash::budget > 0)
+			HostFlash::budget--;
+		HostFlash::image[offset + i] &= bytes[i];
+		HostFlash::programmed++;
+	}
+	return ESP_OK;
+}
+
+inline esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size) {
+	if (offset % HostFlash::SECTOR_SIZE || size % HostFlash::SECTOR_SIZE || offset + size > partition->size)
+		abort();
+	if (HostFlash::budget == 0)
+		return ESP_FAIL;
+
+	memset(HostFlash::image.data() + offset, 0xFF, size);
+	HostFlash::erased += size / HostFlash::SECTOR_SIZE;
+	return ESP_OK;
+}
+
+#endif // HOST_ESP_PARTITION_H
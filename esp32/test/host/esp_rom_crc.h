@@ -0,0 +1,32 @@
+#ifndef HOST_ESP_ROM_CRC_H
+#define HOST_ESP_ROM_CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace HostCrc {
+	struct Table {
+		uint32_t entries[256];
+
+		Table() {
+			for (uint32_t i = 0; i < 256; i++) {
+				uint32_t crc = i;
+				for (int bit = 0; bit < 8; bit++)
+					crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+				entries[i] = crc;
+			}
+		}
+	};
+
+	inline const Table table;
+} // namespace HostCrc
+
+// Same CRC-32 as the ROM (zlib polynomial, table driven like it), continued from `crc`
+inline uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* data, size_t length) {
+	crc = ~crc;
+	for (size_t i = 0; i < length; i++)
+		crc = (crc >> 8) ^ HostCrc::table.entries[(crc ^ data[i]) & 0xFF];
+	return ~crc;
+}
+
+#endif // HOST_ESP_ROM_CRC_H
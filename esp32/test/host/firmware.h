@@ -0,0 +1,28 @@
+#ifndef HOST_FIRMWARE_H
+#define HOST_FIRMWARE_H
+
+// Included first by the host builds: the Arduino subset, and the firmware modules that need the
+// ESP32 (BLE, memory report) replaced by what the icon storage and navigation parts call of them.
+
+#include "Arduino.h"
+
+#define BLE_H
+#define CHA_SETTINGS              "settings"
+#define CHA_NAV                   "nav"
+#define CHA_NAV_TBT_ICON          "icon"
+#define CHA_GPS_SPEED             "speed"
+#define CHA_NAV_SYNC              "navSync"
+#define CHA_NAV_TBT_ICON_MANIFEST "manifest"
+
+inline void setCharacteristicValue(const String&, uint8_t*, size_t) {}
+inline void notifyCharacteristic(const String&, uint8_t*, size_t) {}
+
+#define MEMREPORT_H
+
+namespace MemoryReport {
+	struct Registration {
+		Registration(const char*, size_t) {}
+	};
+} // namespace MemoryReport
+
+#endif // HOST_FIRMWARE_H
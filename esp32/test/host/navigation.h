@@ -0,0 +1,116 @@
+#ifndef HOST_NAVIGATION_H
+#define HOST_NAVIGATION_H
+
+// Included after firmware.h by the host builds of the navigation path: Data (ui.h) reduced to its
+// model, the same InlineString fields without LVGL, and the Telemetry (telemetry.h) counters.
+
+#include "Arduino.h"
+
+#define UI_H
+#define TELEMETRY_H
+
+#include "inlinestring.h"
+#include "keyval.h"
+
+namespace Telemetry {
+	struct Totals {
+		uint32_t frames;
+		uint64_t flush_us;
+		uint32_t coalesced;
+		uint32_t dropped;
+	};
+
+	inline uint32_t coalesced   = 0;
+	inline uint32_t dropped     = 0;
+	inline uint32_t unknownKeys = 0;
+
+	inline void countCoalesced() {
+		coalesced++;
+	}
+
+	inline void countDropped() {
+		dropped++;
+	}
+
+	inline uint32_t countUnknownKey() {
+		return ++unknownKeys;
+	}
+
+	inline Totals totals() {
+		return {0, 0, coalesced, dropped};
+	}
+} // namespace Telemetry
+
+namespace Data {
+	namespace details {
+		inline InlineString<96> nextRoad;
+		inline InlineString<96> nextRoadDesc;
+		inline InlineString<24> eta;
+		inline InlineString<24> ete;
+		inline InlineString<24> distanceToNextTurn;
+		inline InlineString<24> totalDistance;
+		inline InlineString<16> displayIconHash;
+		inline InlineString<16> upcomingIcons[3];
+		inline uint8_t upcomingCount = 0;
+		inline int speed             = -1;
+	} // namespace details
+
+	inline void clear() {
+		details::nextRoad.clear();
+		details::nextRoadDesc.clear();
+		details::eta.clear();
+		details::ete.clear();
+		details::distanceToNextTurn.clear();
+		details::totalDistance.clear();
+		details::displayIconHash.clear();
+		details::upcomingCount = 0;
+		details::speed         = -1;
+	}
+
+	inline void setSpeed(int value) {
+		details::speed = value;
+	}
+
+	inline void setNextRoad(const KvSpan& value) {
+		details::nextRoad.assign(value);
+	}
+
+	inline void setNextRoadDesc(const KvSpan& value) {
+		details::nextRoadDesc.assign(value);
+	}
+
+	inline void setEta(const KvSpan& value) {
+		details::eta.assign(value);
+	}
+
+	inline void setEte(const KvSpan& value) {
+		details::ete.assign(value);
+	}
+
+	inline void setTotalDistance(const KvSpan& value) {
+		details::totalDistance.assign(value);
+	}
+
+	inline void setDistanceToNextTurn(const KvSpan& value) {
+		details::distanceToNextTurn.assign(value);
+	}
+
+	inline void setIconHash(const KvSpan& value) {
+		details::displayIconHash.assign(value);
+	}
+
+	inline void setUpcomingIcons(const KvSpan& span) {
+		details::upcomingCount = 0;
+
+		size_t start = 0;
+		for (size_t i = 0; i <= span.length && details::upcomingCount < 3; i++) {
+			if (i < span.length && span.data[i] != ',')
+				continue;
+			if (i > start)
+				details::upcomingIcons[details::upcomingCount++].assign(KvSpan(span.data + start, i - start));
+			start = i + 1;
+		}
+	}
+} // namespace Data
+
+#endif // HOST_NAVIGATION_H
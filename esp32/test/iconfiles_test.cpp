@@ -0,0 +1,85 @@
+// IconFiles (iconfiles.h) on the in-memory file system: write, read, the saved index, and eviction
+// when either the file system or the index fills up.
+
+#include "host/firmware.h"
+
+#include "iconfiles.h"
+#include "icons.h"
+#include "test.h"
+
+static uint8_t buffer[1 + 4096];
+
+static void start(size_t size) {
+	HostFs::reset(size);
+	CHECK(!IconFiles::init());
+	CHECK(IconFiles::count() == 0);
+}
+
+static bool write(uint32_t i, size_t length) {
+	const auto data = Icons::payload(i, length);
+	return IconFiles::write(Icons::hash(i), 3, data.data(), data.size());
+}
+
+static void writeAndRead() {
+	start(0x20000);
+	for (uint32_t i = 0; i < 20; i++)
+		CHECK(write(i, Icons::length(i)));
+
+	CHECK(IconFiles::count() == 20);
+	for (uint32_t i = 0; i < 20; i++) {
+		const auto data = Icons::payload(i, Icons::length(i));
+		CHECK(IconFiles::read(Icons::hash(i), buffer, sizeof(buffer)) == 1 + data.size());
+		CHECK(buffer[0] == 3 && memcmp(buffer + 1, data.data(), data.size()) == 0);
+	}
+	CHECK(IconFiles::read(Icons::hash(20), buffer, sizeof(buffer)) == 0);
+
+	// The saved index is read back at boot
+	IconFiles::saveIndex();
+	CHECK(IconFiles::init());
+	CHECK(IconFiles::count() == 20);
+}
+
+// More small icons than the index holds, long before the file system fills: each is still indexed,
+// the least used evicted
+static void indexFull() {
+	start(0x100000);
+
+	constexpr uint32_t HOT   = 16;
+	const uint32_t capacity = IconFiles::detail::index.capacity();
+	for (uint32_t i = 0; i < capacity * 3; i++) {
+		CHECK(write(i, 8));
+		CHECK(IconFiles::contains(Icons::hash(i)));
+		CHECK(IconFiles::count() <= capacity);
+
+		for (uint32_t hot = 0; hot < HOT && hot <= i; hot++)
+			IconFiles::countUse(Icons::hash(hot));
+	}
+
+	for (uint32_t hot = 0; hot < HOT; hot++)
+		CHECK(IconFiles::contains(Icons::hash(hot)));
+	CHECK(FLASH_FS.usedBytes() < FLASH_FS.totalBytes() / 4);
+
+	// Evicted files are gone with their index entries
+	uint32_t files = 0;
+	File root = FLASH_FS.open("/");
+	for (File file = root.openNextFile(); file; file = root.openNextFile())
+		files += String(file.name()).endsWith(IconFiles::detail::EXTENSION);
+	CHECK(files == IconFiles::count());
+}
+
+static void fsFull() {
+	start(0x10000);
+	for (uint32_t i = 0; i < 200; i++) {
+		CHECK(write(i, 1024));
+		CHECK(IconFiles::contains(Icons::hash(i)));
+	}
+	CHECK(FLASH_FS.usedBytes() * 100 <= FLASH_FS.totalBytes() * IconFiles::detail::FILL_TARGET);
+	CHECK(IconFiles::count() < 200);
+}
+
+int main() {
+	RUN(writeAndRead);
+	RUN(indexFull);
+	RUN(fsFull);
+	return 0;
+}
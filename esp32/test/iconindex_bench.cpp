@@ -0,0 +1,56 @@
+// Membership check of a cached icon hash at 10, 1k and 10k icons: IconIndex (iconindex.h) against
+// the std::find over a std::vector<String> it replaced. Both include parsing the hash string.
+
+#include "host/firmware.h"
+
+#include "bench.h"
+#include "iconindex.h"
+#include "iconmanifest.h"
+#include "icons.h"
+
+#include <algorithm>
+#include <memory>
+#include <stdio.h>
+
+// Sized like the firmware's tables, at most 3/4 full
+template <uint32_t SLOTS> static void run(uint32_t icons) {
+	auto index = std::make_unique<IconIndex<SLOTS>>();
+	std::vector<String> list;
+	std::vector<String> present, absent;
+
+	for (uint32_t i = 0; i < icons; i++) {
+		const auto hash = Icons::hash(i);
+		index->insert(IconManifest::iconKey(hash), i);
+		list.push_back(hash);
+		present.push_back(hash);
+		absent.push_back(Icons::hash(i + 1000000));
+	}
+
+	volatile long sink = 0;
+	uint32_t next      = 0;
+	const auto lookup  = [&](const std::vector<String>& hashes, auto&& contains) {
+		return Bench::measure([&]() { sink = sink + contains(hashes[next++ % icons]); });
+	};
+	const auto inIndex = [&](const String& hash) { return index->contains(IconManifest::iconKey(hash)); };
+	const auto inList  = [&](const String& hash) { return std::find(list.begin(), list.end(), hash) != list.end(); };
+
+	const auto indexHit  = lookup(present, inIndex);
+	const auto indexMiss = lookup(absent, inIndex);
+	const auto listHit   = lookup(present, inList);
+	const auto listMiss  = lookup(absent, inList);
+
+	printf("%5u icons, %5u slots: IconIndex hit %6.1f ns, miss %6.1f ns | vector<String> hit %9.1f ns, miss %9.1f ns\n",
+	       (unsigned)icons,
+	       (unsigned)SLOTS,
+	       indexHit,
+	       indexMiss,
+	       listHit,
+	       listMiss);
+}
+
+int main() {
+	run<16>(10);
+	run<2048>(1000);
+	run<16384>(10000);
+	return 0;
+}
@@ -0,0 +1,79 @@
+// IconIndex (iconindex.h) against std::map: inserts, removals and rebuild() of a table full of
+// tombstones, keys clustered in the same slots.
+
+#include "iconindex.h"
+#include "test.h"
+
+#include <map>
+
+using Index = IconIndex<256>;
+
+static bool same(const Index& index, const std::map<uint64_t, uint16_t>& expected) {
+	uint32_t count = 0;
+	bool equal     = index.size() == expected.size();
+	index.forEach([&](uint64_t key, uint16_t value) {
+		const auto found = expected.find(key);
+		equal            = equal && found != expected.end() && found->second == value;
+		count++;
+	});
+	for (const auto& entry : expected) {
+		const auto slot = index.find(entry.first);
+		equal           = equal && slot >= 0 && index.value(slot) == entry.second;
+	}
+	return equal && count == expected.size();
+}
+
+static void insertAndRemove() {
+	static Index index;
+	std::map<uint64_t, uint16_t> expected;
+
+	for (uint16_t i = 0; i < 150; i++) {
+		CHECK(index.insert(0x3fa9c01e00ULL + i * 7, i));
+		expected[0x3fa9c01e00ULL + i * 7] = i;
+	}
+	for (uint16_t i = 0; i < 150; i += 3) {
+		index.remove(index.find(0x3fa9c01e00ULL + i * 7));
+		expected.erase(0x3fa9c01e00ULL + i * 7);
+	}
+
+	CHECK(same(index, expected));
+	CHECK(!index.contains(0x3fa9c01e00ULL));
+}
+
+// Keys sharing their low bits probe the same run, tombstones in the middle of it must be dropped
+// without losing the entries after them
+static void rebuild() {
+	static Index index;
+	std::map<uint64_t, uint16_t> expected;
+	uint32_t seed     = 1;
+	uint32_t rebuilds = 0;
+
+	for (uint32_t round = 0; round < 2000; round++) {
+		seed           = seed * 1103515245 + 12345;
+		const auto key = (uint64_t)(seed >> 8) << 8 | (seed % 4 == 0 ? 0xF0 : seed & 0xFF);
+
+		if (expected.count(key) == 0 && expected.size() < 150) {
+			CHECK(index.insert(key, round & 0xFFFF));
+			expected[key] = round & 0xFFFF;
+		} else if (!expected.empty()) {
+			const auto victim = expected.begin();
+			index.remove(index.find(victim->first));
+			expected.erase(victim);
+		}
+
+		if (index.needsRebuild()) {
+			index.rebuild();
+			rebuilds++;
+			CHECK(!index.needsRebuild());
+			CHECK(same(index, expected));
+		}
+	}
+	CHECK(rebuilds > 0);
+	CHECK(same(index, expected));
+}
+
+int main() {
+	RUN(insertAndRemove);
+	RUN(rebuild);
+	return 0;
+}
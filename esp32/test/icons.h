@@ -0,0 +1,77 @@
+#ifndef ICONS_H
+#define ICONS_H
+
+#include "host/Arduino.h"
+
+#include <algorithm>
+#include <math.h>
+#include <vector>
+
+// Synthetic cached icons: 10 hex digit hashes like the phone's, payloads that differ per icon, and
+// turn arrow bitmaps for the codec
+namespace Icons {
+	inline String hash(uint32_t i) {
+		char text[11];
+		snprintf(text, sizeof(text), "%02x%08x", (unsigned)(i * 37 % 256), (unsigned)(i * 2654435761u));
+		return text;
+	}
+
+	inline std::vector<uint8_t> payload(uint32_t i, size_t length) {
+		std::vector<uint8_t> data(length);
+		uint32_t seed = i + 1;
+		for (auto& byte : data) {
+			seed = seed * 1103515245 + 12345;
+			byte = seed >> 16;
+		}
+		return data;
+	}
+
+	// PackBits icons are a few hundred bytes, the largest ones up to 2 KB
+	inline size_t length(uint32_t i) {
+		return 200 + i * 131 % 900;
+	}
+
+	constexpr uint16_t SIZE = 64;
+
+	namespace detail {
+		inline float distanceToSegment(float x, float y, float x0, float y0, float x1, float y1) {
+			const float dx = x1 - x0, dy = y1 - y0;
+			const float t  = std::clamp(((x - x0) * dx + (y - y0) * dy) / (dx * dx + dy * dy), 0.0f, 1.0f);
+			return hypotf(x - x0 - t * dx, y - y0 - t * dy);
+		}
+	} // namespace detail
+
+	// A turn arrow as the phone draws one, SIZE x SIZE: a stem, a bend to the icon's angle and an
+	// arrow head, thick strokes on white. Unpacked rows of 1 or 2 bits of coverage per pixel (leftmost
+	// pixel in the high bits), or 4-bit palette indices, as IconCodec decodes them.
+	inline std::vector<uint8_t> arrow(uint32_t i, uint8_t bitsPerPixel) {
+		const float angle = (int)(i % 9) * 0.35f - 1.4f; // sharp left to sharp right
+		const float width = 3.5f + i % 3;
+		const float endX  = 32 + 22 * sinf(angle);
+		const float endY  = 30 - 22 * cosf(angle);
+		const float headX = 9 * sinf(angle + 2.5f), headY = -9 * cosf(angle + 2.5f);
+		const float wingX = 9 * sinf(angle - 2.5f), wingY = -9 * cosf(angle - 2.5f);
+
+		const uint16_t rowBytes = (SIZE * bitsPerPixel + 7) / 8;
+		std::vector<uint8_t> bitmap(rowBytes * SIZE);
+
+		for (uint16_t y = 0; y < SIZE; y++) {
+			for (uint16_t x = 0; x < SIZE; x++) {
+				const float px = x + 0.5f, py = y + 0.5f;
+				const float distance = std::min({detail::distanceToSegment(px, py, 32, 60, 32, 30),
+				                                 detail::distanceToSegment(px, py, 32, 30, endX, endY),
+				                                 detail::distanceToSegment(px, py, endX, endY, endX + headX, endY + headY),
+				                                 detail::distanceToSegment(px, py, endX, endY, endX + wingX, endY + wingY)});
+				const float coverage = std::clamp(width + 0.5f - distance, 0.0f, 1.0f);
+
+				const uint8_t levels = bitsPerPixel == 1 ? 1 : 3; // I4 uses the first 4 palette entries
+				const uint8_t value  = (uint8_t)lroundf(coverage * levels);
+				const uint32_t bit   = x * bitsPerPixel;
+				bitmap[y * rowBytes + bit / 8] |= value << (8 - bitsPerPixel - bit % 8);
+			}
+		}
+		return bitmap;
+	}
+} // namespace Icons
+
+#endif // ICONS_H
@@ -0,0 +1,159 @@
+// IconStore (iconstore.h) against an emulated NOR flash partition: append, remove, rescan,
+// compaction, eviction, power cuts and a partition left dirty by an earlier user.
+
+#include "host/firmware.h"
+
+#include "iconstore.h"
+#include "icons.h"
+#include "test.h"
+
+static void start(uint32_t sectors) {
+	HostFlash::reset(sectors * HostFlash::SECTOR_SIZE);
+	CHECK(IconStore::init());
+}
+
+static void reboot() {
+	HostFlash::budget = -1;
+	CHECK(IconStore::init());
+}
+
+static bool append(uint32_t i) {
+	const auto data = Icons::payload(i, Icons::length(i));
+	return IconStore::append(Icons::hash(i), 3, data.data(), data.size());
+}
+
+// Found with the payload it was appended with
+static bool holds(uint32_t i) {
+	IconStore::Icon icon;
+	if (!IconStore::find(Icons::hash(i), icon))
+		return false;
+
+	const auto data = Icons::payload(i, Icons::length(i));
+	return icon.format == 3 && icon.length == data.size() && memcmp(icon.data, data.data(), data.size()) == 0;
+}
+
+static void appendAndFind() {
+	start(16);
+	for (uint32_t i = 0; i < 20; i++)
+		CHECK(append(i));
+
+	CHECK(IconStore::count() == 20);
+	for (uint32_t i = 0; i < 20; i++)
+		CHECK(holds(i));
+	CHECK(!IconStore::contains(Icons::hash(20)));
+
+	// Appending a cached icon again writes nothing
+	const auto programmed = HostFlash::programmed;
+	CHECK(append(3));
+	CHECK(HostFlash::programmed == programmed);
+}
+
+static void dirtyPartition() {
+	HostFlash::reset(16 * HostFlash::SECTOR_SIZE);
+	HostFlash::scramble(7);
+	CHECK(IconStore::init());
+	CHECK(IconStore::count() == 0);
+
+	for (uint32_t i = 0; i < 12; i++)
+		CHECK(append(i));
+	for (uint32_t i = 0; i < 12; i++)
+		CHECK(holds(i));
+
+	reboot();
+	CHECK(IconStore::count() == 12);
+	for (uint32_t i = 0; i < 12; i++)
+		CHECK(holds(i));
+}
+
+static void removeAndRescan() {
+	start(16);
+	for (uint32_t i = 0; i < 30; i++)
+		CHECK(append(i));
+	for (uint32_t i = 0; i < 30; i += 6)
+		IconStore::remove(Icons::hash(i));
+
+	reboot();
+	CHECK(IconStore::count() == 25);
+	for (uint32_t i = 0; i < 30; i++)
+		CHECK(holds(i) == (i % 6 != 0));
+}
+
+// Many times the partition size: the oldest sectors are compacted and the store stays consistent
+static void compaction() {
+	start(8);
+	for (uint32_t i = 0; i < 300; i++) {
+		CHECK(append(i));
+		CHECK(holds(i));
+	}
+
+	bool held[300];
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < 300; i++) {
+		held[i] = IconStore::contains(Icons::hash(i));
+		CHECK(!held[i] || holds(i));
+		count += held[i];
+	}
+	CHECK(count == IconStore::count());
+	CHECK(count > 0);
+
+	reboot();
+	CHECK(IconStore::count() == count);
+	for (uint32_t i = 0; i < 300; i++)
+		CHECK(holds(i) == held[i]);
+}
+
+// Icons displayed between compactions survive, the others are evicted
+static void eviction() {
+	constexpr uint32_t HOT = 6;
+
+	start(8);
+	for (uint32_t i = 0; i < HOT; i++)
+		CHECK(append(i));
+
+	for (uint32_t i = HOT; i < 400; i++) {
+		if (i % 8 == 0) {
+			for (uint32_t hot = 0; hot < HOT; hot++) {
+				CHECK(holds(hot));
+				IconStore::countUse(Icons::hash(hot));
+			}
+		}
+		CHECK(append(i));
+	}
+
+	for (uint32_t hot = 0; hot < HOT; hot++)
+		CHECK(holds(hot));
+	CHECK(IconStore::count() < 400 - HOT);
+}
+
+// A record cut before its header is skipped, the store goes on after it
+static void powerCut() {
+	start(16);
+	for (uint32_t i = 0; i < 10; i++)
+		CHECK(append(i));
+
+	HostFlash::cutPowerAfter(300);
+	append(10);
+
+	reboot();
+	CHECK(IconStore::count() == 10);
+	CHECK(!IconStore::contains(Icons::hash(10)));
+	for (uint32_t i = 0; i < 10; i++)
+		CHECK(holds(i));
+
+	for (uint32_t i = 10; i < 20; i++)
+		CHECK(append(i));
+	reboot();
+	CHECK(IconStore::count() == 20);
+	for (uint32_t i = 0; i < 20; i++)
+		CHECK(holds(i));
+}
+
+int main() {
+	RUN(appendAndFind);
+	RUN(dirtyPartition);
+	RUN(removeAndRescan);
+	RUN(compaction);
+	RUN(eviction);
+	RUN(powerCut);
+	return 0;
+}
@@ -0,0 +1,33 @@
+// Parse and lookup cost of a navigation packet (keyval.h), on the host.
+
+#include "bench.h"
+#include "keyval.h"
+
+#include <initializer_list>
+#include <stdio.h>
+
+static const char PACKET[] = "seq=4812\nts=93518771\nnextRd=Nguyen Van Linh\nnextRdDesc=toward Phu My Bridge\n"
+                             "distToNext=350 m\ntotalDist=12.4 km\neta=18:42\nete=23 min\niconHash=3fa9c01e7d\n"
+                             "nextIcons=8b21e0f4a2,77c03d9e15,3fa9c01e7d";
+static const char DELTA[]  = "seq=4813\nts=93519772\ndistToNext=300 m";
+
+int main() {
+	volatile long sink = 0;
+
+	for (const char* packet : {PACKET, DELTA}) {
+		const size_t length = strlen(packet);
+
+		const auto parse = Bench::measure([&]() { sink = sink + kvParse(packet, length).count; });
+		const auto kv    = kvParse(packet, length);
+		const auto hit   = Bench::measure([&]() { sink = sink + kv.get("iconHash").length; });
+		const auto miss  = Bench::measure([&]() { sink = sink + kv.contains("speedLimit"); });
+
+		printf("kvParse %3u B, %2u pairs: parse %6.1f ns, lookup hit %5.1f ns, miss %5.1f ns\n",
+		       (unsigned)length,
+		       kv.count,
+		       parse,
+		       hit,
+		       miss);
+	}
+	return 0;
+}
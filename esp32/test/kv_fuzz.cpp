@@ -0,0 +1,61 @@
+// Fuzz target for the key=value parser (keyval.h), for libFuzzer or fuzz_driver.cpp.
+// The payload is copied to a buffer of its exact size, so a read past it is caught by ASan.
+
+#include "keyval.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+
+// Keys the firmware looks up, short ones catch comparisons that read past the literal
+static const char* const KEYS[] = {"", "a", "seq", "full", "ts", "iconHash", "nextIcons", "speedLimit", "replay"};
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+	char* payload = (char*)malloc(size ? size : 1);
+	memcpy(payload, data, size);
+
+	const auto kv = kvParse(payload, size);
+	if (kv.count > KvParseResult::MAX_PAIRS)
+		abort();
+
+	for (const auto& pair : kv) {
+		// Views stay inside the payload
+		if (pair.key.data < payload || pair.key.data + pair.key.length > payload + size)
+			abort();
+		if (pair.value.data < payload || pair.value.data + pair.value.length > payload + size)
+			abort();
+		if (memchr(pair.key.data, '=', pair.key.length) || memchr(pair.key.data, '\n', pair.key.length))
+			abort();
+
+		for (const char* key : KEYS) {
+			const bool equal = pair.key == key;
+			if (equal != (strlen(key) == pair.key.length && memcmp(pair.key.data, key, pair.key.length) == 0))
+				abort();
+			if (equal == (pair.key != key))
+				abort();
+		}
+
+		// strtol() as the reference, it also skips leading spaces where toInt() stops
+		char* text = (char*)malloc(pair.value.length + 1);
+		memcpy(text, pair.value.data, pair.value.length);
+		text[pair.value.length] = '\0';
+		if (strlen(text) == pair.value.length && (pair.value.isEmpty() || !isspace((uint8_t)text[0])) &&
+		    pair.value.toInt() != strtol(text, nullptr, 10)) {
+			abort();
+		}
+		free(text);
+
+		if (pair.key.hash() != kvHash(pair.key.data, pair.key.length))
+			abort();
+	}
+
+	for (const char* key : KEYS) {
+		const auto* value = kv.find(key);
+		if (kv.get(key).data != (value ? value->data : nullptr))
+			abort();
+		if (kv.getIntOrDefault(key, -1) != (value ? value->toInt() : -1))
+			abort();
+	}
+
+	free(payload);
+	return 0;
+}
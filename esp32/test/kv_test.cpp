@@ -0,0 +1,59 @@
+// KvSpan::toInt() and the parser on the values the firmware reads (keyval.h), out of range ones
+// included: they saturate instead of overflowing.
+
+#include "keyval.h"
+#include "test.h"
+
+#include <limits.h>
+#include <stdio.h>
+
+static long toInt(const char* text) {
+	return KvSpan(text).toInt();
+}
+
+static void digits() {
+	CHECK(toInt("") == 0);
+	CHECK(toInt("-") == 0);
+	CHECK(toInt("42") == 42);
+	CHECK(toInt("+42") == 42);
+	CHECK(toInt("-42") == -42);
+	CHECK(toInt("350 m") == 350);
+	CHECK(toInt("0012") == 12);
+	CHECK(toInt("x12") == 0);
+}
+
+static void overflow() {
+	char text[32];
+
+	snprintf(text, sizeof(text), "%ld", LONG_MAX);
+	CHECK(toInt(text) == LONG_MAX);
+	snprintf(text, sizeof(text), "%ld", LONG_MIN);
+	CHECK(toInt(text) == LONG_MIN);
+
+	// One past the limits
+	snprintf(text, sizeof(text), "%lu", (unsigned long)LONG_MAX + 1);
+	CHECK(toInt(text) == LONG_MAX);
+	snprintf(text, sizeof(text), "-%lu", (unsigned long)LONG_MAX + 2);
+	CHECK(toInt(text) == LONG_MIN);
+
+	CHECK(toInt("99999999999999999999999999999999") == LONG_MAX);
+	CHECK(toInt("-99999999999999999999999999999999") == LONG_MIN);
+}
+
+static void packet() {
+	const char payload[] = "seq=184467440737095516160\nspeed=-99999999999999999999\ndistToNext=350 m";
+	const auto kv        = kvParse(payload, sizeof(payload) - 1);
+
+	CHECK(kv.count == 3);
+	CHECK(kv.getIntOrDefault("seq", -1) == LONG_MAX);
+	CHECK(kv.getIntOrDefault("speed", 0) == LONG_MIN);
+	CHECK(kv.getIntOrDefault("distToNext", 0) == 350);
+	CHECK(kv.getIntOrDefault("eta", -1) == -1);
+}
+
+int main() {
+	RUN(digits);
+	RUN(overflow);
+	RUN(packet);
+	return 0;
+}
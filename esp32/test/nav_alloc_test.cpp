@@ -0,0 +1,125 @@
+// The navigation packet path of processQueue() (esp32.ino) must not allocate: kvParse, NavSync::accept
+// and NavFields::apply over a packet stream as the phone sends it, counted by allocations.h.
+//
+// Built like the firmware with TRACK_ALLOCATIONS and malloc wrapped by the linker, operator new is
+// routed through malloc so the C++ allocations are counted too. The UI is replaced by the model
+// part of Data, see host/navigation.h.
+
+#include "host/firmware.h"
+
+#include "host/navigation.h"
+
+#include "allocations.h"
+#include "navfields.h"
+#include "navsync.h"
+#include "test.h"
+
+#include <new>
+
+void* operator new(size_t size) {
+	if (void* pointer = malloc(size))
+		return pointer;
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept {
+	free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+	free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+	free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+	free(pointer);
+}
+
+// A full snapshot, then deltas: distance updates, a new maneuver, a duplicate, a key from a newer app
+static const char* const STREAM[] = {
+"seq=4812\nfull=1\nts=93518771\nnextRd=Nguyen Van Linh\nnextRdDesc=toward Phu My Bridge\ndistToNext=450 m\n"
+"totalDist=12.4 km\neta=08:42\nete=21 min\niconHash=3fa91c07d2\nnextIcons=3fa91c07d2,8e0b44a1c9,17c2d09e3b\nspeed=42",
+"seq=4813\nts=93519772\ndistToNext=400 m",
+"seq=4814\nts=93520773\ndistToNext=350 m\nspeed=44",
+"seq=4814\nts=93520773\ndistToNext=350 m\nspeed=44",
+"seq=4815\nts=93521774\ndistToNext=300 m\ntotalDist=12.2 km\nete=20 min",
+"seq=4816\nts=93522775\nnextRd=Duong Nguyen Huu Tho, then the third exit at the roundabout onto the long "
+"bridge approach road\nnextRdDesc=\ndistToNext=1.2 km\niconHash=8e0b44a1c9\nnextIcons=8e0b44a1c9,17c2d09e3b",
+"seq=4817\nts=93523776\ndistToNext=1.1 km\nlaneGuidance=0110",
+"seq=4818\nts=93524777\ndistToNext=1 km\nspeed=-1",
+// Legacy full update, no sequence
+"nextRd=Le Van Luong\ndistToNext=80 m\neta=08:43\niconHash=17c2d09e3b\nnextIcons=",
+};
+
+static uint32_t allocations(const char* tag) {
+	const auto& tags = Allocations::detail::tags;
+	return tags[Allocations::detail::tagOf(tag)].allocations;
+}
+
+// processQueue() without the queue and the latency probes
+static void process(const char* payload) {
+	ALLOCATION_STRICT_SCOPE("navigation");
+
+	const auto kv = kvParse(payload, strlen(payload));
+	if (!NavSync::accept(kv))
+		return;
+	NavFields::apply(kv);
+}
+
+// The wrappers see what the navigation path would allocate
+static void counted() {
+	const auto before = allocations("navigation");
+	{
+		ALLOCATION_SCOPE("navigation");
+		String road("a road name longer than any small string buffer");
+		CHECK(road.length() > 0);
+	}
+	CHECK(allocations("navigation") > before);
+}
+
+static void stream() {
+	NavSync::reset();
+
+	const auto before = allocations("navigation");
+	for (int round = 0; round < 100; round++) {
+		for (const auto packet : STREAM)
+			process(packet);
+	}
+	CHECK(allocations("navigation") == before);
+
+	CHECK(Data::details::nextRoad == "Le Van Luong");
+	CHECK(Data::details::nextRoadDesc.isEmpty());
+	CHECK(Data::details::distanceToNextTurn == "80 m");
+	CHECK(Data::details::totalDistance == "12.2 km");
+	CHECK(Data::details::displayIconHash == "17c2d09e3b");
+	CHECK(Data::details::upcomingCount == 0);
+	CHECK(Data::details::speed == -1);
+	CHECK(Telemetry::unknownKeys == 100);
+}
+
+// The resync request after a lost packet builds a String, under its own scope
+static void lostPacket() {
+	NavSync::reset();
+	process(STREAM[0]);
+
+	const auto before = allocations("navigation");
+	process(STREAM[2]);
+	CHECK(!NavSync::detail::synced);
+	CHECK(allocations("navigation") == before);
+}
+
+int main() {
+	Allocations::init();
+
+	RUN(counted);
+	RUN(stream);
+	RUN(lostPacket);
+	return 0;
+}
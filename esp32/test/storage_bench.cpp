@@ -0,0 +1,195 @@
+// The icon storage backends on the navigation access pattern: IconStore (iconstore.h) on the
+// emulated NOR partition against IconFiles (iconfiles.h) on the in-memory file system. Lookup, read,
+// write and enumerate latency on the host, and the write amplification of each.
+//
+//   storage_bench [image]   the icon store partition is loaded from `image` if it exists (e.g. left
+//                           by an earlier run, already compacted many times) and saved to it at the end
+
+#include "host/firmware.h"
+
+#include "bench.h"
+#include "iconfiles.h"
+#include "iconstore.h"
+#include "icons.h"
+
+#include <chrono>
+#include <stdio.h>
+
+constexpr uint32_t POOL           = 1500;  // distinct icons along the routes
+constexpr uint32_t MANEUVERS      = 4000;
+constexpr size_t PARTITION_SIZE   = 0x100000; // icons, see partitions.csv
+constexpr size_t FS_SIZE          = 0xE0000;  // spiffs
+constexpr uint8_t FORMAT          = 3;
+
+// Setup, counters and calls of one backend, as the storage task makes them
+struct Store {
+	static constexpr const char* NAME = "store";
+
+	static void reset(const char* image) {
+		if (!image || !HostFlash::load(image))
+			HostFlash::reset(PARTITION_SIZE);
+		HostFlash::programmed = 0;
+		HostFlash::erased     = 0;
+		IconStore::init();
+	}
+
+	static bool contains(const String& hash) {
+		return IconStore::contains(hash);
+	}
+
+	static bool read(const String& hash) {
+		IconStore::Icon icon;
+		return IconStore::find(hash, icon);
+	}
+
+	static void countUse(const String& hash) {
+		IconStore::countUse(hash);
+	}
+
+	static void write(const String& hash, const std::vector<uint8_t>& data) {
+		IconStore::append(hash, FORMAT, data.data(), data.size());
+	}
+
+	static uint32_t enumerate() {
+		uint32_t count = 0;
+		IconStore::forEach([&count](uint64_t) { count++; });
+		return count;
+	}
+
+	static uint64_t written() {
+		return HostFlash::programmed;
+	}
+
+	static uint64_t erased() {
+		return HostFlash::erased;
+	}
+};
+
+struct Files {
+	static constexpr const char* NAME = "files";
+	static inline uint8_t buffer[1 + 4096];
+
+	static void reset(const char*) {
+		HostFs::reset(FS_SIZE);
+		IconFiles::init();
+		HostFs::resetCounters();
+	}
+
+	static bool contains(const String& hash) {
+		return IconFiles::contains(hash);
+	}
+
+	static bool read(const String& hash) {
+		return IconFiles::read(hash, buffer, sizeof(buffer)) > 0;
+	}
+
+	static void countUse(const String& hash) {
+		IconFiles::countUse(hash);
+	}
+
+	// One icon per batch, IconStorage::commit() saves the index after it
+	static void write(const String& hash, const std::vector<uint8_t>& data) {
+		IconFiles::write(hash, FORMAT, data.data(), data.size());
+		if (IconFiles::hasNewEntries())
+			IconFiles::saveIndex();
+	}
+
+	static uint32_t enumerate() {
+		uint32_t count = 0;
+		IconFiles::forEach([&count](uint64_t) { count++; });
+		return count;
+	}
+
+	// File contents only, the pages and metadata the file system adds are not modelled
+	static uint64_t written() {
+		return HostFs::written;
+	}
+
+	static uint64_t erased() {
+		return 0;
+	}
+};
+
+// Turn arrows come back all the time, junction and lane images rarely: icon u^3 of the pool
+static uint32_t nextIcon(uint32_t& seed) {
+	seed           = seed * 1103515245 + 12345;
+	const double u = (seed >> 8) / double(1 << 24);
+	return POOL * u * u * u;
+}
+
+template <typename Backend> static void run(const char* image) {
+	using Clock = std::chrono::steady_clock;
+
+	Backend::reset(image);
+
+	uint32_t seed     = 1;
+	uint32_t hits     = 0;
+	uint32_t writes   = 0;
+	uint64_t payload  = 0;
+	double writeTotal = 0;
+	double writeWorst = 0;
+
+	// A displayed icon is read and counted when cached, received from the phone and written when not
+	for (uint32_t maneuver = 0; maneuver < MANEUVERS; maneuver++) {
+		const auto i    = nextIcon(seed);
+		const auto hash = Icons::hash(i);
+
+		if (Backend::contains(hash) && Backend::read(hash)) {
+			Backend::countUse(hash);
+			hits++;
+			continue;
+		}
+
+		const auto data  = Icons::payload(i, Icons::length(i));
+		const auto start = Clock::now();
+		Backend::write(hash, data);
+		const auto us = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+
+		writeTotal += us;
+		writeWorst = std::max(writeWorst, us);
+		payload += data.size() + 1;
+		writes++;
+	}
+
+	std::vector<String> held, missing;
+	for (uint32_t i = 0; i < POOL; i++) {
+		if (Backend::contains(Icons::hash(i)))
+			held.push_back(Icons::hash(i));
+		missing.push_back(Icons::hash(POOL + i));
+	}
+
+	volatile long sink = 0;
+	uint32_t next      = 0;
+	const auto hit     = Bench::measure([&]() { sink = sink + Backend::contains(held[next++ % held.size()]); });
+	const auto miss    = Bench::measure([&]() { sink = sink + Backend::contains(missing[next++ % missing.size()]); });
+	const auto read    = Bench::measure([&]() { sink = sink + Backend::read(held[next++ % held.size()]); });
+	const auto listed  = Bench::measure([&]() { sink = sink + Backend::enumerate(); });
+
+	printf("%-5s %4u held, %4u/%u hits | lookup hit %6.1f ns, miss %6.1f ns | read %7.1f ns | "
+	       "write %6.1f us (worst %7.1f us) | enumerate %6.1f us | amplification %5.2f, %llu sectors erased\n",
+	       Backend::NAME,
+	       (unsigned)held.size(),
+	       (unsigned)hits,
+	       (unsigned)MANEUVERS,
+	       hit,
+	       miss,
+	       read,
+	       writes ? writeTotal / writes : 0,
+	       writeWorst,
+	       listed / 1000,
+	       payload ? double(Backend::written()) / payload : 0,
+	       (unsigned long long)Backend::erased());
+}
+
+int main(int argc, char** argv) {
+	const char* image = argc > 1 ? argv[1] : nullptr;
+
+	run<Store>(image);
+	run<Files>(nullptr);
+
+	if (image && !HostFlash::save(image)) {
+		fprintf(stderr, "%s not written\n", image);
+		return 1;
+	}
+	return 0;
+}
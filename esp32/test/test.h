@@ -0,0 +1,21 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHECK(condition)                                                                           \
+	do {                                                                                           \
+		if (!(condition)) {                                                                        \
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition);          \
+			exit(1);                                                                               \
+		}                                                                                          \
+	} while (0)
+
+#define RUN(test)                                                                                  \
+	do {                                                                                           \
+		test();                                                                                    \
+		printf("ok   %s\n", #test);                                                                \
+	} while (0)
+
+#endif // TEST_H
@@ -28,6 +28,12 @@ namespace ThemeControl {
 		}
 	} // namespace detail
 
+	// The dark theme turns the panel inversion off, it shows the complement of what is drawn. Flashes
+	// do not count, they are over in a few hundred ms.
+	bool isInverted() {
+		return !detail::isLight;
+	}
+
 	void flashScreen() {
 		if (millis() > detail::lastFlashRequest_ms + 5000) {
 			detail::lastFlashRequest_ms = millis();
@@ -0,0 +1,88 @@
+#ifndef THROUGHPUT_H
+#define THROUGHPUT_H
+
+#include "ble.h"
+#include "connparams.h"
+#include "keyval.h"
+
+/**
+ * Throughput test mode on CHA_THROUGHPUT, meant to be driven by a test central (e.g. a BlueZ
+ * script) to compare link configurations.
+ *
+ * Writes starting with 0x00 are payload and only counted, anything else is a command:
+ *   bench=start          reset the counters
+ *   bench=stop           notify the result: bytes, packets, ms, Bps and the current link
+ *                        configuration (mtu, dle, phy, interval)
+ *   bench=ping\nid=<n>   notify pong=<n> right away, for round trip latency
+ */
+namespace Throughput {
+	namespace detail {
+		bool running      = false;
+		uint32_t bytes    = 0;
+		uint32_t packets  = 0;
+		uint32_t first_us = 0;
+		uint32_t last_us  = 0;
+
+		void notify(const String& message) {
+			notifyCharacteristic(CHA_THROUGHPUT, (uint8_t*)message.c_str(), message.length());
+		}
+
+		void report() {
+			const auto& link         = ConnParams::link();
+			const uint32_t duration  = last_us - first_us;
+			const uint32_t perSecond = duration ? (uint64_t)bytes * 1000000 / duration : 0;
+
+			String message;
+			message.reserve(160);
+			message += "bytes=" + String(bytes);
+			message += "\npackets=" + String(packets);
+			message += "\nms=" + String(duration / 1000);
+			message += "\nBps=" + String(perSecond);
+			message += "\nmtu=" + String(BLEDevice::getMTU());
+			message += "\ndle=" + String(link.dataLength);
+			message += "\nphy=" + String(link.txPhy) + "/" + String(link.rxPhy);
+			message += "\ninterval_us=" + String(link.interval * 1250);
+
+			Serial.println(message);
+			notify(message);
+		}
+	} // namespace detail
+
+	void onWrite(const uint8_t* data, size_t length) {
+		using namespace detail;
+
+		if (length == 0)
+			return;
+
+		if (data[0] == 0x00) {
+			if (!running)
+				return;
+
+			last_us = micros();
+			if (packets == 0)
+				first_us = last_us;
+
+			bytes += length;
+			packets++;
+			return;
+		}
+
+		const auto kv      = kvParse(data, length);
+		const auto command = kv.get("bench");
+
+		if (command == "start") {
+			running  = true;
+			bytes    = 0;
+			packets  = 0;
+			first_us = 0;
+			last_us  = 0;
+		} else if (command == "stop") {
+			running = false;
+			report();
+		} else if (command == "ping") {
+			notify(String("pong=") + kv.getOrDefault("id"));
+		}
+	}
+} // namespace Throughput
+
+#endif // THROUGHPUT_H
@@ -2,18 +2,28 @@
 #define UI_H
 
 #define LV_LVGL_H_INCLUDE_SIMPLE
+#include "allocations.h"
 #include "config.h"
+#include "fixedqueue.h"
+#include "iconcache.h"
+#include "iconcodec.h"
+#include "iconmanifest.h"
+#include "iconpixels.h"
+#include "iconstorage.h"
+#include "inlinestring.h"
 #include "lcd.h"
+#include "latency.h"
 #include "local_fonts.h"
+#include "memreport.h"
+#include "storagetask.h"
+#include "telemetry.h"
 #include "theme.h"
 
-#include "FS.h"
-#include "SPIFFS.h"
 #include "ble.h"
+#include "flashfs.h"
 #include <lvgl.h>
 
-#define FS                      SPIFFS
-#define FORMAT_SPIFFS_IF_FAILED true
+#define FORMAT_FS_IF_FAILED     true
 
 // ICON CONFIG — 64x64 icons
 #define ICON_HEIGHT             64
@@ -22,6 +32,33 @@
 // 1-bit bitmap buffer & RGB565 render buffer
 #define ICON_BITMAP_BUFFER_SIZE ((ICON_HEIGHT * ICON_WIDTH) / 8)
 #define ICON_RENDER_BUFFER_SIZE (ICON_WIDTH * ICON_HEIGHT * (LV_COLOR_DEPTH / 8))
+// Anti-aliased icons are 2 bits per pixel, colour icons 4-bit palette indices up to 64x64
+#define ICON_BITMAP_MAX_SIZE    (IconCodec::indexedSize(ICON_WIDTH, ICON_HEIGHT))
+// Largest encoded icon payload (PackBits worst case), stored as [format][payload] on flash
+#define ICON_DATA_MAX_SIZE      (IconCodec::INDEXED_HEADER_SIZE + IconCodec::packBitsMaxSize(ICON_BITMAP_MAX_SIZE))
+#define ICON_HASH_CAPACITY      16
+// Decoded icons kept in RAM: slots of one LVGL I4 icon (palette and indices), an RGB565 icon takes 4
+#define ICON_CACHE_SLOT_SIZE    (IconCodec::PALETTE_SIZE * sizeof(lv_color32_t) + ICON_BITMAP_MAX_SIZE)
+#define ICON_CACHE_SLOTS        16
+// Received icons waiting to be written to flash
+#define ICON_WRITE_BACKLOG      4
+// Displayed icons whose use is not counted on flash yet
+#define ICON_USE_BACKLOG        8
+// Upcoming maneuver icons (nextIcons) decoded ahead of time, fewer than the cache entries
+#define ICON_PREFETCH_COUNT     3
+
+// Build with -DICON_TIMING to log the time of every icon decode, read and write on Serial
+#ifdef ICON_TIMING
+#define ICON_TIMER(name)                     const auto name = micros()
+#define ICON_TIMING_LOG(name, format, ...)   Serial.printf(format, micros() - name, __VA_ARGS__)
+#else
+#define ICON_TIMER(name)
+#define ICON_TIMING_LOG(name, format, ...)
+#endif
+
+// Navigation text fields, in bytes of UTF-8
+#define NAV_ROAD_CAPACITY  96
+#define NAV_SHORT_CAPACITY 24
 
 
 // SCREEN SIZE from config.h (HORIZONTAL or VERTICAL)
@@ -41,6 +78,7 @@
 #define DRAW_BUF_SIZE   (SCREEN_WIDTH * DRAW_BUF_HEIGHT)
 
 uint16_t draw_buf_0[DRAW_BUF_SIZE];
+const MemoryReport::Registration drawBufferRegistration{"draw_buf_0", sizeof(draw_buf_0)};
 
 
 // LCD INSTANCE
@@ -75,7 +113,12 @@ void my_print(lv_log_level_t level, const char* buf) {
 // LVGL FLUSH CALLBACK (LVGL 9)
 // ---------------------------
 void my_disp_flush(lv_display_t* disp, const lv_area_t* area, uint8_t* px_map) {
+    const auto start_us = micros();
     lcd.flushWindow(area->x1, area->y1, area->x2, area->y2, (uint16_t*)px_map);
+    const auto end_us = micros();
+    const auto last   = lv_display_flush_is_last(disp);
+    Telemetry::onFlush(end_us - start_us, last);
+    Latency::onFlush(start_us, end_us, last);
     lv_display_flush_ready(disp);
 }
 
@@ -86,21 +129,78 @@ static uint32_t my_tick(void) {
 
 namespace Data {
     namespace details {
-        int speed                 = -1;
-        String nextRoad           = String();
-        String nextRoadDesc       = String();
-        String eta                = String();
-        String ete                = String();
-        String distanceToNextTurn = String();
-        String totalDistance      = String();
-        String displayIconHash    = String();
-        String receivedIconHash   = String();
-        bool iconDirty            = false;
-
-        std::vector<String> availableIcons{};
-        uint8_t receivedIconBitmapBuffer[ICON_BITMAP_BUFFER_SIZE];
-        uint8_t iconBitmapBuffer[ICON_BITMAP_BUFFER_SIZE];
-        uint8_t iconRenderBuffer[ICON_RENDER_BUFFER_SIZE];
+        int speed = -1;
+        InlineString<NAV_ROAD_CAPACITY> nextRoad;
+        InlineString<NAV_ROAD_CAPACITY> nextRoadDesc;
+        InlineString<NAV_SHORT_CAPACITY> eta;
+        InlineString<NAV_SHORT_CAPACITY> ete;
+        InlineString<NAV_SHORT_CAPACITY> distanceToNextTurn;
+        InlineString<NAV_SHORT_CAPACITY> totalDistance;
+        InlineString<ICON_HASH_CAPACITY> displayIconHash;
+        // Filled by the BLE task while receivedIconReady is false, taken by update()
+        String receivedIconHash = String();
+        std::atomic<bool> receivedIconReady{false};
+
+        // Label texts set with lv_label_set_text_static, LVGL reads them on every redraw
+        char speedText[8]                         = "";
+        char etaText[3 * NAV_SHORT_CAPACITY + 16] = "";
+        uint8_t receivedIconFormat = IconCodec::FORMAT_1BPP;
+        size_t receivedIconLength  = 0;
+        bool iconDirty             = false;
+
+        uint8_t receivedIconBuffer[ICON_DATA_MAX_SIZE];
+        uint8_t iconFileBuffer[1 + ICON_DATA_MAX_SIZE];
+        IconCache<ICON_CACHE_SLOT_SIZE, ICON_CACHE_SLOTS> iconCache;
+        // 1 and 2-bpp icons, and the blank icon
+        constexpr IconImage RGB565_ICON = {ICON_WIDTH, ICON_HEIGHT, ICON_WIDTH * 2, LV_COLOR_FORMAT_RGB565, ICON_RENDER_BUFFER_SIZE};
+
+        struct PendingIcon {
+            char hash[ICON_HASH_CAPACITY + 1];
+            uint8_t format;
+            size_t length;
+            uint8_t data[ICON_DATA_MAX_SIZE];
+        };
+
+        struct IconUse {
+            char hash[ICON_HASH_CAPACITY + 1];
+            bool unreadable; // cached but failed to load, dropped instead
+        };
+
+        // Filled by the loop, drained by the storage task
+        FixedQueue<PendingIcon, ICON_WRITE_BACKLOG> pendingIcons;
+        FixedQueue<IconUse, ICON_USE_BACKLOG> iconUses;
+
+        // Index and use counts of icon files, saved by the storage task
+        std::atomic<bool> flushRequested{false};
+        // Settings removeAllFiles=1 from the BLE task, passed on to the storage task by update()
+        std::atomic<bool> removeRequested{false};
+        std::atomic<bool> clearRequested{false};
+
+        // Not loaded yet, the storage task held the index
+        bool iconLoadPending = false;
+
+        // One is prefetched per update, those before `prefetched` are done
+        InlineString<ICON_HASH_CAPACITY> upcomingIcons[ICON_PREFETCH_COUNT];
+        uint8_t upcomingCount = 0;
+        uint8_t prefetched    = 0;
+        static_assert(ICON_PREFETCH_COUNT < ICON_CACHE_SLOTS * ICON_CACHE_SLOT_SIZE / ICON_RENDER_BUFFER_SIZE,
+                      "The displayed icon needs an entry");
+
+        std::atomic<bool> iconBenchmarkRequested{false};
+        // Input of benchmarkIconKernels(), not shared with the icon reads of iconFileBuffer
+        uint8_t benchmarkBitmap[2 * ICON_BITMAP_BUFFER_SIZE];
+
+        // Palettes of colour icons are complemented for the dark theme, see ThemeControl::isInverted()
+        bool iconsInverted = false;
+
+        const MemoryReport::Registration registrations[] = {
+            {"iconCache", sizeof(iconCache)},
+            {"pendingIcons", sizeof(pendingIcons)},
+            {"iconUses", sizeof(iconUses)},
+            {"iconReceived", sizeof(receivedIconBuffer)},
+            {"iconFile", sizeof(iconFileBuffer)},
+            {"iconBenchmark", sizeof(benchmarkBitmap)},
+        };
     }
 }
 
@@ -117,6 +217,8 @@ namespace UI {
         lv_obj_t* imgTbtIcon;
 
         uint32_t lastUpdate = 0;
+
+        constexpr lv_opa_t STALE_OPA = LV_OPA_40;
     }
 
 
@@ -277,18 +379,42 @@ namespace UI {
         if (Data::details::iconDirty) {
             Data::details::iconDirty = false;
 
+            const auto& image = Data::details::iconCache.displayedImage();
+
             static lv_img_dsc_t icon;
-            icon.header.cf     = LV_COLOR_FORMAT_RGB565;
-            icon.header.w      = ICON_WIDTH;
-            icon.header.h      = ICON_HEIGHT;
-            icon.header.stride = ICON_WIDTH * (LV_COLOR_DEPTH / 8);
-            icon.data_size     = ICON_RENDER_BUFFER_SIZE;
-            icon.data          = (const uint8_t*)Data::details::iconRenderBuffer;
+            icon.header.cf     = image.colorFormat;
+            icon.header.w      = image.width;
+            icon.header.h      = image.height;
+            icon.header.stride = image.stride;
+            icon.data_size     = image.size;
+            icon.data          = Data::details::iconCache.displayed();
 
             lv_img_set_src(imgTbtIcon, &icon);
         }
     }
 
+    // ---------------------------
+    // STALE DATA (link health)
+    // ---------------------------
+    void setSpeedStale(bool stale) {
+        using namespace details;
+
+        const lv_opa_t opa = stale ? STALE_OPA : LV_OPA_COVER;
+        lv_obj_set_style_opa(lblSpeed, opa, LV_PART_MAIN);
+        lv_obj_set_style_opa(lblSpeedUnit, opa, LV_PART_MAIN);
+    }
+
+    void setNavigationStale(bool stale) {
+        using namespace details;
+
+        const lv_opa_t opa = stale ? STALE_OPA : LV_OPA_COVER;
+        lv_obj_set_style_opa(imgTbtIcon, opa, LV_PART_MAIN);
+        lv_obj_set_style_opa(lblDistanceToNextRoad, opa, LV_PART_MAIN);
+        lv_obj_set_style_opa(lblNextRoad, opa, LV_PART_MAIN);
+        lv_obj_set_style_opa(lblNextRoadDesc, opa, LV_PART_MAIN);
+        lv_obj_set_style_opa(lblEta, opa, LV_PART_MAIN);
+    }
+
 } // namespace UI
 
 
@@ -323,42 +449,59 @@ namespace Data {
     void clearSpeedData();
     int speed();
     void setSpeed(const int& value);
-    String nextRoad();
-    void setNextRoad(const String& value);
-    String nextRoadDesc();
-    void setNextRoadDesc(const String& value);
-    String eta();
-    void setEta(const String& value);
-    String ete();
-    void setEte(const String& value);
-    String totalDistance();
-    void setTotalDistance(const String& value);
-    String distanceToNextTurn();
-    void setDistanceToNextTurn(const String& value);
-    String displayIconHash();
-    void setIconHash(const String& value);
-    uint8_t* iconRenderBuffer();
-    void setIconBuffer(const uint8_t* value, const size_t& length);
-    String fullEta();
-    void saveIcon(const String& iconHash, const uint8_t* buffer);
+    const char* nextRoad();
+    void setNextRoad(const KvSpan& value);
+    const char* nextRoadDesc();
+    void setNextRoadDesc(const KvSpan& value);
+    const char* eta();
+    void setEta(const KvSpan& value);
+    const char* ete();
+    void setEte(const KvSpan& value);
+    const char* totalDistance();
+    void setTotalDistance(const KvSpan& value);
+    const char* distanceToNextTurn();
+    void setDistanceToNextTurn(const KvSpan& value);
+    const char* displayIconHash();
+    void setIconHash(const KvSpan& value);
+    void setUpcomingIcons(const KvSpan& value);
+    const uint8_t* iconRenderBuffer();
+    bool setIconBuffer(const uint8_t* value, const size_t& length, const uint8_t format = IconCodec::FORMAT_1BPP);
+    bool iconImage(const uint8_t* value, const size_t length, const uint8_t format, IconImage& image);
+    bool decodeIcon(uint8_t* buffer, const IconImage& image, const uint8_t* value, const size_t length, const uint8_t format);
+    bool decodeIndexedIcon(uint8_t* buffer, const IconImage& image, const uint8_t* value, const size_t length, const uint8_t format);
+    bool prefetchIconData(uint64_t key, const uint8_t* value, const size_t length, const uint8_t format);
+    void setIconColors(const lv_color_t color, const lv_color_t bgColor);
+    void requestIconBenchmark();
+    void benchmarkIconKernels();
+    const char* fullEta();
+    void saveIcon(const String& iconHash, const uint8_t format, const uint8_t* buffer, const size_t length);
+    void persistIcon(const String& iconHash, const uint8_t format, const uint8_t* buffer, const size_t length);
+    void persistIcons();
     bool isIconExisted(const String& iconHash);
-    void loadIcon(const String& iconHash);
-    void receiveNewIcon(const String& iconHash, const uint8_t* buffer);
+    void countIconUse(const KvSpan& iconHash, bool unreadable = false);
+    bool readIcon(const String& iconHash, IconStorage::Icon& icon);
+    bool loadIcon(const String& iconHash);
+    void loadDisplayedIcon();
+    void prefetchIcon();
+    bool isUpcomingIcon(const String& iconHash);
+    bool receiveNewIcon(const String& iconHash, const uint8_t format, const uint8_t* buffer, const size_t length);
+    void requestRemoveAllFiles();
     void removeAllFiles();
-    void listFiles();
-    size_t readFile(const String& filename, uint8_t* buffer, const size_t bufferSize);
-    void writeFile(const String& filename, const uint8_t* buffer, const size_t& length);
 
 
     // ----------------------
     // DATA STORAGE CONTROL
     // ----------------------
     void init() {
-        if (!FS.begin(FORMAT_SPIFFS_IF_FAILED)) {
-            Serial.println("Error mounting SPIFFS");
+        if (!FLASH_FS.begin(FORMAT_FS_IF_FAILED)) {
+            Serial.println("Error mounting " FLASH_FS_NAME);
             return;
         }
-        listFiles();
+        StorageTask::start(persistIcons);
+        setIconColors(lv_color_make(0, 0, 255), lv_color_make(255, 255, 255));
+
+        StorageTask::Lock lock;
+        IconStorage::init(details::iconFileBuffer, sizeof(details::iconFileBuffer));
     }
 
     bool hasNavigationData() {
@@ -373,14 +516,20 @@ namespace Data {
     }
 
     void clearNavigationData() {
-        details::nextRoad     = "";
-        details::nextRoadDesc = "";
-        details::eta          = "";
-        details::ete          = "";
-        details::distanceToNextTurn = "";
-        details::totalDistance      = "";
-        details::displayIconHash    = "";
-        details::receivedIconHash   = "";
+        details::nextRoad.clear();
+        details::nextRoadDesc.clear();
+        details::eta.clear();
+        details::ete.clear();
+        details::distanceToNextTurn.clear();
+        details::totalDistance.clear();
+        details::displayIconHash.clear();
+        details::iconLoadPending = false;
+
+        // The labels point into the cleared fields, redraw them
+        lv_label_set_text_static(UI::details::lblNextRoad, details::nextRoad.c_str());
+        lv_label_set_text_static(UI::details::lblNextRoadDesc, details::nextRoadDesc.c_str());
+        lv_label_set_text_static(UI::details::lblDistanceToNextRoad, details::distanceToNextTurn.c_str());
+        lv_label_set_text_static(UI::details::lblEta, fullEta());
     }
 
     void clearSpeedData() {
@@ -397,219 +546,532 @@ namespace Data {
         details::speed = value;
 
         if (value == -1) {
-            lv_label_set_text(UI::details::lblSpeed, "");
+            details::speedText[0] = '\0';
         } else {
-            lv_label_set_text(UI::details::lblSpeed, String(value).c_str());
+            snprintf(details::speedText, sizeof(details::speedText), "%d", value);
         }
+        lv_label_set_text_static(UI::details::lblSpeed, details::speedText);
     }
 
-    String nextRoad() {
-        return hasNavigationData() ? details::nextRoad : "---";
+    const char* nextRoad() {
+        return hasNavigationData() ? details::nextRoad.c_str() : "---";
     }
 
-    void setNextRoad(const String& value) {
-        if (value == details::nextRoad) return;
+    void setNextRoad(const KvSpan& value) {
+        if (!details::nextRoad.assign(value)) return;
 
         if (!value.isEmpty()) {
             ThemeControl::flashScreen();
         }
 
-        details::nextRoad = value;
-        lv_label_set_text(UI::details::lblNextRoad, value.c_str());
+        lv_label_set_text_static(UI::details::lblNextRoad, details::nextRoad.c_str());
     }
 
-    String nextRoadDesc() {
-        return hasNavigationData() ? details::nextRoadDesc : "---";
+    const char* nextRoadDesc() {
+        return hasNavigationData() ? details::nextRoadDesc.c_str() : "---";
     }
 
-    void setNextRoadDesc(const String& value) {
-        if (value == details::nextRoadDesc) return;
-
-        details::nextRoadDesc = value;
-        lv_label_set_text(UI::details::lblNextRoadDesc, value.c_str());
+    void setNextRoadDesc(const KvSpan& value) {
+        if (!details::nextRoadDesc.assign(value)) return;
+        lv_label_set_text_static(UI::details::lblNextRoadDesc, details::nextRoadDesc.c_str());
     }
 
-    String eta() {
-        return hasNavigationData() ? details::eta : "---";
+    const char* eta() {
+        return hasNavigationData() ? details::eta.c_str() : "---";
     }
 
-    void setEta(const String& value) {
-        if (value == details::eta) return;
-        details::eta = value;
-        lv_label_set_text(UI::details::lblEta, fullEta().c_str());
+    void setEta(const KvSpan& value) {
+        if (!details::eta.assign(value)) return;
+        lv_label_set_text_static(UI::details::lblEta, fullEta());
     }
 
-    String ete() {
-        return hasNavigationData() ? details::ete : "---";
+    const char* ete() {
+        return hasNavigationData() ? details::ete.c_str() : "---";
     }
 
-    void setEte(const String& value) {
-        if (value == details::ete) return;
-        details::ete = value;
-        lv_label_set_text(UI::details::lblEta, fullEta().c_str());
+    void setEte(const KvSpan& value) {
+        if (!details::ete.assign(value)) return;
+        lv_label_set_text_static(UI::details::lblEta, fullEta());
     }
 
-    String totalDistance() {
-        return hasNavigationData() ? details::totalDistance : "---";
+    const char* totalDistance() {
+        return hasNavigationData() ? details::totalDistance.c_str() : "---";
     }
 
-    void setTotalDistance(const String& value) {
-        if (value == details::totalDistance) return;
-        details::totalDistance = value;
-        lv_label_set_text(UI::details::lblEta, fullEta().c_str());
+    void setTotalDistance(const KvSpan& value) {
+        if (!details::totalDistance.assign(value)) return;
+        lv_label_set_text_static(UI::details::lblEta, fullEta());
     }
 
-    String distanceToNextTurn() {
-        return hasNavigationData() ? details::distanceToNextTurn : "---";
+    const char* distanceToNextTurn() {
+        return hasNavigationData() ? details::distanceToNextTurn.c_str() : "---";
     }
 
-    void setDistanceToNextTurn(const String& value) {
-        if (value == details::distanceToNextTurn) return;
-        details::distanceToNextTurn = value;
-        lv_label_set_text(UI::details::lblDistanceToNextRoad, value.c_str());
+    void setDistanceToNextTurn(const KvSpan& value) {
+        if (!details::distanceToNextTurn.assign(value)) return;
+        lv_label_set_text_static(UI::details::lblDistanceToNextRoad, details::distanceToNextTurn.c_str());
     }
 
-    // ETA format
-    String fullEta() {
-        return ete() + " - " + totalDistance() + " - " + eta();
+    // ETA format, formatted in place
+    const char* fullEta() {
+        snprintf(details::etaText, sizeof(details::etaText), "%s - %s - %s", ete(), totalDistance(), eta());
+        return details::etaText;
     }
 
-    String displayIconHash() {
-        return details::displayIconHash;
+    const char* displayIconHash() {
+        return details::displayIconHash.c_str();
     }
 
-    void setIconHash(const String& value) {
-        if (value == details::displayIconHash) return;
+    void setIconHash(const KvSpan& span) {
+        if (!details::displayIconHash.assign(span)) return;
 
-        details::displayIconHash = value;
-
-        if (value.isEmpty()) {
+        details::iconLoadPending = false;
+        if (span.isEmpty()) {
             setIconBuffer(nullptr, 0);
             return;
         }
 
-        if (isIconExisted(value)) {
-            loadIcon(value);
+        // Seen recently, already decoded
+        if (details::iconCache.show(IconManifest::iconKey(span.data, span.length))) {
+            details::iconDirty = true;
+            countIconUse(span);
             return;
         }
 
-        // icon will arrive via BLE
+        details::iconLoadPending = true;
+        loadDisplayedIcon();
     }
 
-    uint8_t* iconRenderBuffer() {
-        return details::iconRenderBuffer;
+    // From flash, or asked from the phone. Tried again by update() while the storage task holds the index.
+    void loadDisplayedIcon() {
+        // Only when the maneuver icon changes, not counted against the navigation packet
+        ALLOCATION_SCOPE("icon");
+        const String value = details::displayIconHash.c_str();
+
+        {
+            StorageTask::TryLock lock;
+            if (!lock) return;
+
+            details::iconLoadPending = false;
+            if (loadIcon(value)) {
+                countIconUse(value);
+                return;
+            }
+        }
+
+        // icon will arrive via BLE, unless the phone thinks we already have it
+        const auto message = String("icon=") + value + "\nmissing=1";
+        notifyCharacteristic(CHA_NAV_TBT_ICON_ACK, (uint8_t*)message.c_str(), message.length());
     }
 
-    void setIconBuffer(const uint8_t* value, const size_t& length) {
-        if (!value || length == 0) {
-            memset(details::iconRenderBuffer, 0xFF, sizeof(details::iconRenderBuffer));
-            details::iconDirty = true;
-            return;
+    // Comma separated icon hashes of the next maneuvers, soonest first
+    void setUpcomingIcons(const KvSpan& span) {
+        details::upcomingCount = 0;
+        details::prefetched    = 0;
+
+        size_t start = 0;
+        for (size_t i = 0; i <= span.length && details::upcomingCount < ICON_PREFETCH_COUNT; i++) {
+            if (i < span.length && span.data[i] != ',') continue;
+            if (i > start) details::upcomingIcons[details::upcomingCount++].assign(KvSpan(span.data + start, i - start));
+            start = i + 1;
         }
+    }
+
+    const uint8_t* iconRenderBuffer() {
+        return details::iconCache.displayed();
+    }
 
-        if (length > ICON_BITMAP_BUFFER_SIZE) {
+    // Decodes into a free icon cache buffer and displays it, returns false if there was no valid icon
+    bool setIconBuffer(const uint8_t* value, const size_t& length, const uint8_t format) {
+        if (length > ICON_DATA_MAX_SIZE) {
             Serial.println("Icon buffer overflow");
-            return;
+            return false;
         }
 
-        convert1BitBitmapToRgb565(details::iconRenderBuffer,
-                                  value,
-                                  ICON_WIDTH,
-                                  ICON_HEIGHT,
-                                  lv_color_to_u16(lv_color_make(0, 0, 255)),
-                                  lv_color_to_u16(lv_color_make(255, 255, 255)));
+        IconImage image;
+        if (!iconImage(value, length, format, image)) image = details::RGB565_ICON;
 
+        uint8_t* buffer    = details::iconCache.acquire(image);
         details::iconDirty = true;
+
+        return decodeIcon(buffer, image, value, length, format);
+    }
+
+    // How `value` is laid out once decoded, false if its header is invalid
+    bool iconImage(const uint8_t* value, const size_t length, const uint8_t format, IconImage& image) {
+        if (!IconCodec::isIndexed(format)) {
+            image = details::RGB565_ICON;
+            return true;
+        }
+
+        if (!value || length < IconCodec::INDEXED_HEADER_SIZE) return false;
+
+        const uint8_t width  = value[0];
+        const uint8_t height = value[1];
+        if (width == 0 || height == 0 || width > ICON_WIDTH || height > ICON_HEIGHT) return false;
+
+        image = {width,
+                 height,
+                 (uint16_t)((width + 1) / 2),
+                 LV_COLOR_FORMAT_I4,
+                 (uint32_t)(IconCodec::PALETTE_SIZE * sizeof(lv_color32_t) + IconCodec::indexedSize(width, height))};
+        return true;
+    }
+
+    // Into a cache buffer laid out as `image` (see iconImage()), left blank if the icon is invalid
+    bool decodeIcon(uint8_t* buffer, const IconImage& image, const uint8_t* value, const size_t length, const uint8_t format) {
+        if (!value || length == 0) {
+            memset(buffer, 0xFF, image.size);
+            return false;
+        }
+
+        ICON_TIMER(start_us);
+        bool ok;
+
+        if (IconCodec::isIndexed(format)) {
+            ok = image.colorFormat == LV_COLOR_FORMAT_I4 && decodeIndexedIcon(buffer, image, value, length, format);
+        } else {
+            // Decode straight into the render buffer, 8 or 4 pixels per decoded byte
+            const auto expected = ICON_BITMAP_BUFFER_SIZE * IconCodec::bitsPerPixel(format);
+            uint16_t* pixel     = (uint16_t*)buffer;
+
+            ok = IconCodec::bitsPerPixel(format) == 2
+                ? IconCodec::decode(format, value, length, expected, [&pixel](uint8_t bits) { pixel = IconPixels::expand2(bits, pixel); })
+                : IconCodec::decode(format, value, length, expected, [&pixel](uint8_t bits) { pixel = IconPixels::expand1(bits, pixel); });
+        }
+
+        if (!ok) {
+            Serial.println("Invalid icon data");
+            memset(buffer, 0xFF, image.size);
+            return false;
+        }
+
+        ICON_TIMING_LOG(start_us, "Icon decoded in %luus (%u -> %u B)\n", (unsigned)length, (unsigned)image.size);
+        return true;
+    }
+
+    // LVGL I4: 16 ARGB8888 palette entries, then the indices as they were sent. The inverted panel
+    // complements the palette back to the colours that were sent.
+    bool decodeIndexedIcon(uint8_t* buffer, const IconImage& image, const uint8_t* value, const size_t length, const uint8_t format) {
+        const uint8_t mask = details::iconsInverted ? 0xFF : 0x00;
+
+        auto* palette = (lv_color32_t*)buffer;
+        for (size_t i = 0; i < IconCodec::PALETTE_SIZE; i++) {
+            const uint16_t color = value[2 + 2 * i] | value[3 + 2 * i] << 8;
+            palette[i]           = lv_color32_make((((color >> 11) & 0x1F) * 255 / 31) ^ mask,
+                                         (((color >> 5) & 0x3F) * 255 / 63) ^ mask,
+                                         ((color & 0x1F) * 255 / 31) ^ mask,
+                                         0xFF);
+        }
+
+        uint8_t* indices = buffer + IconCodec::PALETTE_SIZE * sizeof(lv_color32_t);
+        return IconCodec::decode(format,
+                                 value + IconCodec::INDEXED_HEADER_SIZE,
+                                 length - IconCodec::INDEXED_HEADER_SIZE,
+                                 IconCodec::indexedSize(image.width, image.height),
+                                 [&indices](uint8_t bits) { *indices++ = bits; });
+    }
+
+    // Into the icon cache without displaying it
+    bool prefetchIconData(uint64_t key, const uint8_t* value, const size_t length, const uint8_t format) {
+        IconImage image;
+        if (!iconImage(value, length, format, image)) return false;
+
+        return details::iconCache.prefetch(key, image, [&](uint8_t* buffer) {
+            return decodeIcon(buffer, image, value, length, format);
+        });
+    }
+
+    // Cached icons were decoded with the old colours, the displayed one stays until the next icon
+    void setIconColors(const lv_color_t color, const lv_color_t bgColor) {
+        IconPixels::setColors(lv_color_to_u16(color), lv_color_to_u16(bgColor));
+        details::iconCache.clear();
+    }
+
+    // From the BLE task (settings iconBenchmark=1), run by the next update()
+    void requestIconBenchmark() {
+        details::iconBenchmarkRequested = true;
+    }
+
+    // The per-pixel loop against the table kernels, on a pseudo-random bitmap. 128x128 is four
+    // 64x64 tiles, the output goes to a cache entry that is not displayed and is left empty.
+    void benchmarkIconKernels() {
+        constexpr uint8_t ROUNDS = 10;
+
+        uint8_t* bitmap = details::benchmarkBitmap;
+        uint32_t seed   = 1;
+        for (size_t i = 0; i < sizeof(details::benchmarkBitmap); i++) {
+            seed      = seed * 1103515245 + 12345;
+            bitmap[i] = seed >> 16;
+        }
+
+        details::iconCache.prefetch(0, details::RGB565_ICON, [bitmap](uint8_t* buffer) {
+            const auto color   = lv_color_to_u16(lv_color_make(0, 0, 255));
+            const auto bgColor = lv_color_to_u16(lv_color_make(255, 255, 255));
+
+            const auto time = [](uint8_t tiles, auto&& kernel) {
+                const auto start_us = micros();
+                for (uint8_t round = 0; round < ROUNDS; round++) {
+                    for (uint8_t tile = 0; tile < tiles; tile++)
+                        kernel();
+                }
+                return (micros() - start_us) / ROUNDS;
+            };
+
+            for (uint8_t tiles : {1, 4}) {
+                const auto perPixel = time(tiles, [&]() {
+                    convert1BitBitmapToRgb565(buffer, bitmap, ICON_WIDTH, ICON_HEIGHT, color, bgColor);
+                });
+                const auto table1 = time(tiles, [&]() {
+                    uint16_t* pixel = (uint16_t*)buffer;
+                    for (size_t i = 0; i < ICON_BITMAP_BUFFER_SIZE; i++)
+                        pixel = IconPixels::expand1(bitmap[i], pixel);
+                });
+                const auto table2 = time(tiles, [&]() {
+                    uint16_t* pixel = (uint16_t*)buffer;
+                    for (size_t i = 0; i < 2 * ICON_BITMAP_BUFFER_SIZE; i++)
+                        pixel = IconPixels::expand2(bitmap[i], pixel);
+                });
+
+                Serial.printf("Icon kernels %ux%u: per pixel %luus, 1-bpp table %luus, 2-bpp table %luus\n",
+                              (unsigned)(tiles == 1 ? ICON_WIDTH : 2 * ICON_WIDTH),
+                              (unsigned)(tiles == 1 ? ICON_HEIGHT : 2 * ICON_HEIGHT),
+                              perPixel,
+                              table1,
+                              table2);
+            }
+            return false;
+        });
     }
 
     // FILE FUNCTIONS
+    // From the BLE task, the files are removed by the storage task
+    void requestRemoveAllFiles() {
+        details::removeRequested = true;
+    }
+
+    // Storage task side
     void removeAllFiles() {
-        File root = FS.open("/");
+        File root = FLASH_FS.open("/");
         File file = root.openNextFile();
         while (file) {
-            FS.remove(file.path());
+            FLASH_FS.remove(file.path());
             file = root.openNextFile();
         }
+
+        IconStorage::clear();
     }
 
-    void listFiles() {
-        File root = FS.open("/");
-        File file = root.openNextFile();
+    // False while the storage task changes the index, persistIcon() checks again
+    bool isIconExisted(const String& iconHash) {
+        StorageTask::TryLock lock;
 
-        details::availableIcons.clear();
+        return lock && IconStorage::contains(iconHash);
+    }
 
-        while (file) {
-            String name = file.name();
-            if (name.endsWith(".bin")) {
-                String hash = name.substring(0, name.length() - 4);
-                details::availableIcons.push_back(hash);
-            }
-            file = root.openNextFile();
+    // Written by the storage task, update() waits for room in the backlog
+    void saveIcon(const String& iconHash, const uint8_t format, const uint8_t* buffer, const size_t length) {
+        if (iconHash.length() > ICON_HASH_CAPACITY || length > ICON_DATA_MAX_SIZE) {
+            Serial.println("Icon not saved, invalid hash or size");
+            return;
+        }
+
+        auto* pending = details::pendingIcons.prepare();
+        if (!pending) {
+            Serial.println("Icon not saved, write backlog full");
+            return;
         }
+
+        memcpy(pending->hash, iconHash.c_str(), iconHash.length() + 1);
+        pending->format = format;
+        pending->length = length;
+        memcpy(pending->data, buffer, length);
+
+        details::pendingIcons.commit();
+        StorageTask::wake();
     }
 
-    size_t readFile(const String& filename, uint8_t* buffer, const size_t bufferSize) {
-        File file = FS.open(filename, FILE_READ);
-        if (!file || file.isDirectory()) return 0;
+    // Counted by the storage task, the loop only reads the index. A full backlog loses the use.
+    void countIconUse(const KvSpan& iconHash, bool unreadable) {
+        auto* use = details::iconUses.prepare();
+        if (!use || iconHash.length > ICON_HASH_CAPACITY) return;
 
-        if (file.size() > bufferSize) return 0;
+        memcpy(use->hash, iconHash.data, iconHash.length);
+        use->hash[iconHash.length] = '\0';
+        use->unreadable            = unreadable;
 
-        size_t length = file.read(buffer, bufferSize);
-        file.close();
-        return length;
+        details::iconUses.commit();
+        StorageTask::wake();
     }
 
-    void writeFile(const String& filename, const uint8_t* buffer, const size_t& length) {
-        File file = FS.open(filename, FILE_WRITE);
-        if (!file) return;
-        file.write(buffer, length);
-        file.close();
+    // Storage task side
+    void persistIcons() {
+        if (details::clearRequested.exchange(false)) removeAllFiles();
+
+        while (!details::pendingIcons.empty()) {
+            const auto& pending = details::pendingIcons.front();
+            persistIcon(pending.hash, pending.format, pending.data, pending.length);
+            details::pendingIcons.pop();
+        }
+
+        while (!details::iconUses.empty()) {
+            const auto& use = details::iconUses.front();
+            if (use.unreadable) IconStorage::drop(use.hash);
+            else IconStorage::countUse(use.hash);
+            details::iconUses.pop();
+        }
+
+        IconStorage::commit();
+
+        if (details::flushRequested.exchange(false)) IconStorage::flush();
     }
 
-    bool isIconExisted(const String& iconHash) {
-        return std::find(details::availableIcons.begin(),
-                         details::availableIcons.end(),
-                         iconHash)
-               != details::availableIcons.end();
+    // Icons are stored as they were received: [format][payload], see IconStorage
+    void persistIcon(const String& iconHash, const uint8_t format, const uint8_t* buffer, const size_t length) {
+        // The index is only changed by this task
+        if (IconStorage::contains(iconHash)) return;
+
+        ICON_TIMER(start_us);
+        if (!IconStorage::write(iconHash, format, buffer, length)) return;
+
+        ICON_TIMING_LOG(start_us, "Icon saved in %luus (%s)\n", IconStorage::name());
+        IconManifest::add(iconHash);
     }
 
-    void saveIcon(const String& iconHash, const uint8_t* buffer) {
-        if (isIconExisted(iconHash)) return;
+    // Caller holds StorageTask::TryLock. Returns false if the icon is not cached.
+    bool readIcon(const String& iconHash, IconStorage::Icon& icon) {
+        ICON_TIMER(start_us);
+
+        if (!IconStorage::read(iconHash, icon, details::iconFileBuffer, sizeof(details::iconFileBuffer))) {
+            if (IconStorage::contains(iconHash)) countIconUse(iconHash, true);
+            return false;
+        }
 
-        writeFile(String("/") + iconHash + ".bin", buffer, ICON_BITMAP_BUFFER_SIZE);
-        details::availableIcons.push_back(iconHash);
+        ICON_TIMING_LOG(start_us, "Icon read in %luus (%s)\n", IconStorage::name());
+        return true;
     }
 
-    void loadIcon(const String& iconHash) {
-        if (!isIconExisted(iconHash)) return;
+    // Caller holds StorageTask::TryLock while decoding, the icon store data is read in place.
+    // Returns false if the icon is not cached.
+    bool loadIcon(const String& iconHash) {
+        IconStorage::Icon icon;
+        if (!readIcon(iconHash, icon)) return false;
 
-        readFile(String("/") + iconHash + ".bin",
-                 details::iconBitmapBuffer,
-                 ICON_BITMAP_BUFFER_SIZE);
+        if (setIconBuffer(icon.data, icon.length, icon.format))
+            details::iconCache.remember(IconManifest::iconKey(iconHash));
+        return true;
+    }
+
+    // Decodes an upcoming icon into the icon cache, so switching maneuvers waits on neither flash nor BLE
+    void prefetchIcon() {
+        if (details::prefetched >= details::upcomingCount) return;
 
-        setIconBuffer(details::iconBitmapBuffer, ICON_BITMAP_BUFFER_SIZE);
+        const auto& hash = details::upcomingIcons[details::prefetched];
+        const auto key   = IconManifest::iconKey(hash.c_str(), hash.length());
+        if (details::iconCache.contains(key)) {
+            details::prefetched++;
+            return;
+        }
+
+        ALLOCATION_SCOPE("icon");
+        const String value = hash.c_str();
+
+        {
+            // Tried again by the next update
+            StorageTask::TryLock lock;
+            if (!lock) return;
+            details::prefetched++;
+
+            IconStorage::Icon icon;
+            if (readIcon(value, icon)) {
+                prefetchIconData(key, icon.data, icon.length, icon.format);
+                return;
+            }
+        }
+
+        // Sent by the phone unless another icon is on its way
+        const auto message = String("icon=") + value + "\nmissing=1\nprefetch=1";
+        notifyCharacteristic(CHA_NAV_TBT_ICON_ACK, (uint8_t*)message.c_str(), message.length());
     }
 
-    void receiveNewIcon(const String& iconHash, const uint8_t* buffer) {
-        if (iconHash == details::receivedIconHash) return;
+    bool isUpcomingIcon(const String& iconHash) {
+        for (uint8_t i = 0; i < details::upcomingCount; i++) {
+            if (KvSpan(iconHash) == details::upcomingIcons[i].c_str()) return true;
+        }
+        return false;
+    }
+
+    // From the BLE task. False if the icon was not taken: invalid, or the previous one is not handled
+    // yet (e.g. the write backlog is full). IconTransfer then has the phone send it again.
+    bool receiveNewIcon(const String& iconHash, const uint8_t format, const uint8_t* buffer, const size_t length) {
+        if (details::receivedIconReady) return iconHash == details::receivedIconHash;
+
+        if (iconHash.length() > ICON_HASH_CAPACITY || length > ICON_DATA_MAX_SIZE || !IconCodec::isKnownFormat(format)) {
+            Serial.println("Invalid icon");
+            return false;
+        }
 
-        details::receivedIconHash = iconHash;
-        memcpy(details::receivedIconBitmapBuffer, buffer, ICON_BITMAP_BUFFER_SIZE);
+        details::receivedIconHash   = iconHash;
+        details::receivedIconFormat = format;
+        details::receivedIconLength = length;
+        memcpy(details::receivedIconBuffer, buffer, length);
+        details::receivedIconReady = true;
+        return true;
     }
 
     // Apply icon once per update cycle
     void update() {
-        if (details::receivedIconHash.isEmpty()) return;
+        IconManifest::update();
+
+        // Theme changed: icons decoded for the other one are dropped, a displayed colour icon reloaded
+        if (ThemeControl::isInverted() != details::iconsInverted) {
+            details::iconsInverted = !details::iconsInverted;
+            details::iconCache.clear();
+            if (!details::displayIconHash.isEmpty() &&
+                details::iconCache.displayedImage().colorFormat == LV_COLOR_FORMAT_I4) {
+                details::iconLoadPending = true;
+            }
+        }
+
+        if (details::removeRequested.exchange(false)) {
+            details::clearRequested = true;
+            StorageTask::wake();
+        }
+
+        if (IconStorage::isFlushDue()) {
+            details::flushRequested = true;
+            StorageTask::wake();
+        }
+
+        if (details::iconLoadPending) loadDisplayedIcon();
+        prefetchIcon();
+
+        if (details::iconBenchmarkRequested.exchange(false)) benchmarkIconKernels();
+
+        if (!details::receivedIconReady) return;
+
+        // Taken only with room in the write backlog, so an accepted icon is never dropped
+        const bool existed = isIconExisted(details::receivedIconHash);
+        if (!existed && details::pendingIcons.size() >= ICON_WRITE_BACKLOG) return;
 
-        if (!isIconExisted(details::receivedIconHash)) {
-            saveIcon(details::receivedIconHash, details::receivedIconBitmapBuffer);
+        // Displayed or cached straight from RAM, written to flash in the background
+        const auto key = IconManifest::iconKey(details::receivedIconHash);
+        if (details::displayIconHash == details::receivedIconHash) {
+            details::iconLoadPending = false;
+            if (setIconBuffer(details::receivedIconBuffer, details::receivedIconLength, details::receivedIconFormat))
+                details::iconCache.remember(key);
+        } else if (isUpcomingIcon(details::receivedIconHash)) {
+            prefetchIconData(key, details::receivedIconBuffer, details::receivedIconLength, details::receivedIconFormat);
         }
 
-        if (details::receivedIconHash == details::displayIconHash) {
-            setIconBuffer(details::receivedIconBitmapBuffer, ICON_BITMAP_BUFFER_SIZE);
+        if (!existed) {
+            saveIcon(details::receivedIconHash,
+                     details::receivedIconFormat,
+                     details::receivedIconBuffer,
+                     details::receivedIconLength);
         }
 
-        details::receivedIconHash = "";
+        details::receivedIconReady = false;
     }
 
 } // namespace Data